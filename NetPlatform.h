@@ -48,6 +48,20 @@ t_syserr NetPlatform_addAddress(const char* interfaceName,
 t_syserr NetPlatform_setMTU(const char* interfaceName,
                         uint32_t mtu);
 
+/// Configuration of one interface for NetPlatform_configureInterfaces()
+struct NetPlatform_ifConfig {
+    const char* interfaceName;
+    const uint8_t* address; ///< 4 or 16 bytes (by addrFam), or NULL to add no address
+    int prefixLen;
+    int addrFam; ///< Sockaddr_AF_INET or Sockaddr_AF_INET6
+    uint32_t mtu; ///< 0 to keep the MTU
+};
+
+/// Brings up each interface, sets its MTU and adds its address; on linux in few netlink messages for all of them.
+/// @return value <0 if an error occured (then later interfaces may be not configured).
+t_syserr NetPlatform_configureInterfaces(const struct NetPlatform_ifConfig* configs,
+                                     int count);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -16,6 +16,7 @@
 #ifdef __MACH__
 
 #include "Endian.h"
+#include "NetPlatform.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <errno.h>
@@ -244,5 +245,21 @@ t_syserr NetPlatform_setMTU(const char* interfaceName,
     return (t_syserr){0,0};
 }
 
+/// @return .my_code: 0=ok; Errors: as of NetPlatform_addAddress and NetPlatform_setMTU
+t_syserr NetPlatform_configureInterfaces(const struct NetPlatform_ifConfig* configs,
+                                     int count)
+{
+    for (int i = 0; i < count; i++) {
+        t_syserr result = (t_syserr){0,0};
+        if (configs[i].mtu) result = NetPlatform_setMTU(configs[i].interfaceName, configs[i].mtu);
+        if (result.my_code < 0) return result;
+        if (configs[i].address) {
+            result = NetPlatform_addAddress(configs[i].interfaceName, configs[i].address,
+                configs[i].prefixLen, configs[i].addrFam);
+        }
+        if (result.my_code < 0) return result;
+    }
+    return (t_syserr){0,0};
+}
 
 #endif // __MACH__
@@ -29,187 +29,198 @@
 
 #include <string.h>
 #include <errno.h>
-#include <stdio.h>
-#include <sys/ioctl.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <stdlib.h>
 #include <stddef.h>
 #include <net/if.h>
-#include <arpa/inet.h>
-#include <linux/ipv6_route.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
 #include <stdint.h>
 
-/**
- * This hack exists because linux/in.h and linux/in6.h define
- * the same structures, leading to redefinition errors.
- * For the second operand, we're grateful to android/bionic, platform level 21.
- */
-#if !defined(_LINUX_IN6_H) && !defined(_UAPI_LINUX_IN6_H)
-    struct in6_ifreq
-    {
-        struct in6_addr ifr6_addr;
-        uint32_t ifr6_prefixlen;
-        int ifr6_ifindex;
-    };
-#endif
-
 const int Sockaddr_AF_INET = AF_INET;
 const int Sockaddr_AF_INET6 = AF_INET6;
 
-/**
- * Get a socket and ifRequest for a given interface by name.
- *
- * @param interfaceName the name of the interface, eg: tun0
- * @param af either AF_INET or AF_INET6
- * @param eg an exception handler in case something goes wrong.
- *           this will send a -1 for all errors.
- * @param ifRequestOut an ifreq which will be populated with the interface index of the interface.
- * @return a socket for interacting with this interface; Errors: -220 socket open,
- * -230 ioctl
+/*
+ * The interfaces are configured with rtnetlink: for each one RTM_NEWLINK (MTU, IFF_UP) and RTM_NEWADDR are written
+ * into one buffer, and many of them are sent by one sendmsg(); the kernel acks each, and the acks are read back
+ * in few recv() calls. One netlink socket is used for all of them.
  */
-static t_syserr socketForIfName(const char* interfaceName,
-						int af,
-                           struct ifreq* ifRequestOut)
-{
-    int s;
-    int err;
 
-    if ((s = socket(af, SOCK_DGRAM, 0)) < 0) {
-        return (t_syserr){ e_netplatform_err_socketForIfName_open , errno };
-    }
+/// messages sent in one sendmsg(), so that their acks fit into the default receive buffer of the socket
+#define NetPlatform_MESSAGES_PER_BATCH 64
+#define NetPlatform_BATCH_BUFFER_SIZE (NetPlatform_MESSAGES_PER_BATCH * 128)
+
+struct NetPlatform_batch {
+    int socket;
+    uint32_t firstSeq; ///< seq of the first message in buffer
+    uint32_t nextSeq;
+    size_t used; ///< bytes of buffer used
+    union {
+        struct nlmsghdr align; ///< keeps the buffer aligned for netlink headers
+        char bytes[NetPlatform_BATCH_BUFFER_SIZE];
+    } buffer;
+};
+
+/// @return new message of type in the batch (with NLM_F_ACK), or NULL if the buffer has no room for it
+static struct nlmsghdr* batchAddMessage(struct NetPlatform_batch* batch, uint16_t type, uint16_t flags, size_t payloadSize)
+{
+    const size_t size = NLMSG_SPACE(payloadSize) + 64; // room for the attributes after the payload
+    if (batch->used + size > sizeof(batch->buffer.bytes)) return NULL;
+    struct nlmsghdr* message = (struct nlmsghdr*)(batch->buffer.bytes + batch->used);
+    memset(message, 0, size);
+    message->nlmsg_len = NLMSG_LENGTH(payloadSize);
+    message->nlmsg_type = type;
+    message->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    message->nlmsg_seq = batch->nextSeq++;
+    return message;
+}
 
-    memset(ifRequestOut, 0, sizeof(struct ifreq));
-    strncpy(ifRequestOut->ifr_name, interfaceName, IFNAMSIZ);
+/// appends attribute to message (the room was reserved by batchAddMessage)
+static void messageAddAttribute(struct nlmsghdr* message, uint16_t type, const void* data, size_t size)
+{
+    struct rtattr* attribute = (struct rtattr*)((char*)message + NLMSG_ALIGN(message->nlmsg_len));
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(size);
+    memcpy(RTA_DATA(attribute), data, size);
+    message->nlmsg_len = NLMSG_ALIGN(message->nlmsg_len) + RTA_ALIGN(attribute->rta_len);
+}
 
-    if (ioctl(s, SIOCGIFINDEX, ifRequestOut) < 0) {
-	    	err = errno;
-        close(s);
-        return (t_syserr){ e_netplatform_err_checkInterfaceUp_ioctl, err };
+/// sends all messages of the batch and reads their acks; @return the first error the kernel reported for them
+static t_syserr batchFlush(struct NetPlatform_batch* batch)
+{
+    t_syserr result = { 0, 0 };
+    if (batch->used == 0) return result;
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    struct iovec iov = { batch->buffer.bytes, batch->used };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &kernel;
+    msg.msg_namelen = sizeof(kernel);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (sendmsg(batch->socket, &msg, 0) < 0) return (t_syserr){ e_netplatform_err_netlink_send, errno };
+
+    uint32_t acked = 0; // every message gets one ack (NLMSG_ERROR, with error 0 if it was done)
+    const uint32_t expected = batch->nextSeq - batch->firstSeq;
+    while (acked < expected) {
+        union {
+            struct nlmsghdr align;
+            char bytes[8192];
+        } answer;
+        const ssize_t size = recv(batch->socket, answer.bytes, sizeof(answer.bytes), 0);
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            return (t_syserr){ e_netplatform_err_netlink_recv, errno };
+        }
+        int left = (int)size;
+        for (struct nlmsghdr* header = &answer.align; NLMSG_OK(header, left); header = NLMSG_NEXT(header, left)) {
+            if (header->nlmsg_type != NLMSG_ERROR) continue;
+            if ((header->nlmsg_seq < batch->firstSeq) || (header->nlmsg_seq >= batch->nextSeq)) continue; // not ours
+            ++acked;
+            const struct nlmsgerr* error = (const struct nlmsgerr*)NLMSG_DATA(header);
+            if ((error->error != 0) && (result.my_code == 0)) {
+                result = (t_syserr){ e_netplatform_err_netlink_answer, -error->error };
+            }
+        }
     }
-    return (t_syserr){ s , 0 };
+    batch->used = 0;
+    batch->firstSeq = batch->nextSeq;
+    return result;
 }
 
-/// @return 0=ok; Errors: -320 socket open, -330 ioctl
-static t_syserr checkInterfaceUp(int socket,
-                             struct ifreq* ifRequest)
+/// adds RTM_NEWLINK that sets MTU (if not 0) and brings the link up, and RTM_NEWADDR if address is given
+static int batchAddInterface(struct NetPlatform_batch* batch, int ifIndex, const struct NetPlatform_ifConfig* config)
 {
-		int err=0;
-
-    if (ioctl(socket, SIOCGIFFLAGS, ifRequest) < 0) {
-	    	err = errno;
-        close(socket);
-        return (t_syserr){ e_netplatform_err_checkInterfaceUp_open, err };
+    const size_t usedBefore = batch->used;
+    const uint32_t seqBefore = batch->nextSeq;
+
+    struct nlmsghdr* link = batchAddMessage(batch, RTM_NEWLINK, 0, sizeof(struct ifinfomsg));
+    if (!link) return 0;
+    struct ifinfomsg* info = (struct ifinfomsg*)NLMSG_DATA(link);
+    info->ifi_family = AF_UNSPEC;
+    info->ifi_index = ifIndex;
+    info->ifi_flags = IFF_UP;
+    info->ifi_change = IFF_UP;
+    if (config->mtu) messageAddAttribute(link, IFLA_MTU, &config->mtu, sizeof(config->mtu));
+    batch->used += NLMSG_ALIGN(link->nlmsg_len);
+
+    if (config->address) {
+        const size_t addressSize = (config->addrFam == AF_INET6) ? 16 : 4;
+        struct nlmsghdr* address = batchAddMessage(batch, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, sizeof(struct ifaddrmsg));
+        if (!address) { // both or none, so the batch can be flushed and this interface added again
+            batch->used = usedBefore;
+            batch->nextSeq = seqBefore;
+            return 0;
+        }
+        struct ifaddrmsg* addressInfo = (struct ifaddrmsg*)NLMSG_DATA(address);
+        addressInfo->ifa_family = (unsigned char)config->addrFam;
+        addressInfo->ifa_prefixlen = (unsigned char)config->prefixLen;
+        addressInfo->ifa_index = (unsigned)ifIndex;
+        messageAddAttribute(address, IFA_LOCAL, config->address, addressSize);
+        messageAddAttribute(address, IFA_ADDRESS, config->address, addressSize);
+        batch->used += NLMSG_ALIGN(address->nlmsg_len);
     }
+    return 1;
+}
 
-    if (ifRequest->ifr_flags & IFF_UP & IFF_RUNNING) {
-        // already up.
-        return (t_syserr){ 0 , 0 }; // all ok
+/**
+ * @return 0=ok; Errors: -100 invalid addrFam, -230 no such interface,
+ * -40/-41 netlink send/recv, -42 kernel refused a change (its errno in errno_copy)
+ */
+t_syserr NetPlatform_configureInterfaces(const struct NetPlatform_ifConfig* configs, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const int addrFam = configs[i].addrFam;
+        if (configs[i].address && (addrFam != Sockaddr_AF_INET) && (addrFam != Sockaddr_AF_INET6)) {
+            return (t_syserr){ e_netplatform_err_invalid_addr_family, 0 };
+        }
     }
 
-
-    ifRequest->ifr_flags |= IFF_UP | IFF_RUNNING;
-    if (ioctl(socket, SIOCSIFFLAGS, ifRequest) < 0) {
-	    	err = errno;
-        close(socket);
-        return (t_syserr){ e_netplatform_err_checkInterfaceUp_ioctl, err };
+    struct NetPlatform_batch batch;
+    batch.socket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (batch.socket < 0) return (t_syserr){ e_netplatform_err_open_socket, errno };
+    batch.firstSeq = batch.nextSeq = 1;
+    batch.used = 0;
+
+    t_syserr result = { 0, 0 };
+    for (int i = 0; (i < count) && (result.my_code == 0); i++) {
+        const int ifIndex = (int)if_nametoindex(configs[i].interfaceName);
+        if (ifIndex == 0) {
+            result = (t_syserr){ e_netplatform_err_socketForIfName_ioctl, errno };
+            break;
+        }
+        if (!batchAddInterface(&batch, ifIndex, &configs[i])) { // batch is full
+            result = batchFlush(&batch);
+            if (result.my_code == 0) batchAddInterface(&batch, ifIndex, &configs[i]);
+        }
     }
-    return (t_syserr){ 0 , 0 };
+    if (result.my_code == 0) result = batchFlush(&batch);
+    close(batch.socket);
+    return result;
 }
 
-/**
- * @return: 0=ok; Errors: -10 getaddrinfo, -20 socket open, -30 ioctl; -100 invalid addrFam -101 not implemented
-   during socketForIfName:  -220 socket open, -230 ioctl,
-   during checkInterfaceUp: -320 socket open, -330 ioctl
- */
+/// @return 0=ok; Errors: see NetPlatform_configureInterfaces
 t_syserr NetPlatform_addAddress(const char* interfaceName,
                             const uint8_t* address,
                             int prefixLen,
                             int addrFam)
 {
-		int err=0;
-    struct ifreq ifRequest;
-    int s;
-    int ifIndex;
-    t_syserr s_and_syserr = socketForIfName(interfaceName, addrFam, &ifRequest);
-    if (s_and_syserr.my_code < 0) return (t_syserr){ s , 0 }; // some error
-    s = s_and_syserr.my_code;
-    ifIndex = ifRequest.ifr_ifindex;
-
-    // checkInterfaceUp() clobbers the ifindex.
-    t_syserr ifUp = checkInterfaceUp(s, &ifRequest);
-    if (ifUp.my_code < 0) return ifUp; // some error
-
-    if (addrFam == Sockaddr_AF_INET6) {
-        struct in6_ifreq ifr6;
-        memset( &ifr6 , 0, sizeof(ifr6) ); // just to be sure
-        ifr6.ifr6_prefixlen = prefixLen;
-        ifr6.ifr6_ifindex = ifIndex;
-        /* = {
-            ifIndex,
-            prefixLen
-        };*/
-        memcpy(&ifr6.ifr6_addr, address, 16);
-
-        if (ioctl(s, SIOCSIFADDR, &ifr6) < 0) { // errno
-        		err = errno;
-            close(s);
-            return (t_syserr){ e_netplatform_err_ioctl, err };
-        }
-
-
-    } else if (addrFam == Sockaddr_AF_INET) {
-			printf("setting ipv4 address\n");
-			printf("not implemented\n");
-            return (t_syserr){ e_netplatform_err_not_impl_addr_family, 0 };
-        /*struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = 0 };
-        memcpy(&sin.sin_addr.s_addr, address, 4);
-        memcpy(&ifRequest.ifr_addr, &sin, sizeof(struct sockaddr));
-
-        if (ioctl(s, SIOCSIFADDR, &ifRequest) < 0) {
-            close(s);
-        }
-
-        uint32_t x = ~0 << (32 - prefixLen);
-        x = Endian_hostToBigEndian32(x);
-        memcpy(&sin.sin_addr, &x, 4);
-        memcpy(&ifRequest.ifr_addr, &sin, sizeof(struct sockaddr_in));
-
-        if (ioctl(s, SIOCSIFNETMASK, &ifRequest) < 0) {
-            close(s);
-        }*/
-    } else {
-        return (t_syserr){ e_netplatform_err_invalid_addr_family, 0 };
-    }
-
-    close(s);
-    return (t_syserr){ 0 , 0 };
+    const struct NetPlatform_ifConfig config = { interfaceName, address, prefixLen, addrFam, 0 };
+    return NetPlatform_configureInterfaces(&config, 1);
 }
 
-/**
- * @return 0=ok
- */
+/// @return 0=ok; Errors: see NetPlatform_configureInterfaces
 t_syserr NetPlatform_setMTU(const char* interfaceName,
                         uint32_t mtu)
 {
-    struct ifreq ifRequest;
-    int err;
-    int s;
-    t_syserr s_and_syserr = socketForIfName(interfaceName, AF_INET6, &ifRequest);
-    if (s_and_syserr.my_code<0) return s_and_syserr; // some err
-    s = s_and_syserr.my_code;
-
-    ifRequest.ifr_mtu = mtu;
-    if (ioctl(s, SIOCSIFMTU, &ifRequest) < 0) { // errno
-    		err = errno;
-        close(s);
-        return (t_syserr){ e_netplatform_err_ioctl, err };
-    }
-
-    close(s);
-    return (t_syserr){ 0 , 0 };
+    const struct NetPlatform_ifConfig config = { interfaceName, NULL, 0, AF_UNSPEC, mtu };
+    return NetPlatform_configureInterfaces(&config, 1);
 }
 
 #endif // __linux__
+/* vim: set expandtab ts=4 sw=4: */
@@ -0,0 +1,337 @@
+// Microbenchmarks of the building blocks of the receive path, each on its own.
+// The Time column is ns/op; cycles/op is from the time stamp counter (reference cycles, not core clock).
+// Run e.g.: tun_test_bench --benchmark_filter=packet_check --benchmark_repetitions=5
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+
+#include "../buffer_pool.hpp"
+#include "../counter.hpp"
+#include "../device.hpp"
+#include "../generator.hpp"
+#include "../ip_packet.hpp"
+#include "../packet_check.hpp"
+#include "../pcap_capture.hpp"
+#include "../read_loop.hpp"
+#include "../transform.hpp"
+#include "../verify.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+std::atomic<size_t> count_mallocs(0); ///< calls of the global operator new, see below
+}
+
+// count every heap allocation of the process, so a benchmark can show how many it does per operation;
+// not inlined, so that the compiler does not pair new expressions with the free() inside (-Wmismatched-new-delete)
+__attribute__((noinline)) void *operator new(size_t size) {
+	count_mallocs.fetch_add(1, std::memory_order_relaxed);
+	void *pointer = std::malloc(size ? size : 1);
+	if (!pointer) throw std::bad_alloc();
+	return pointer;
+}
+__attribute__((noinline)) void operator delete(void *pointer) noexcept {
+	std::free(pointer);
+}
+__attribute__((noinline)) void operator delete(void *pointer, size_t) noexcept {
+	std::free(pointer);
+}
+
+namespace {
+
+uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0; // no cycle counter known, cycles/op shows 0
+#endif
+}
+
+/// Measures cycles of the whole benchmark loop it lives in, and reports them per iteration as cycles/op
+class c_cycles_per_op final {
+	public:
+		explicit c_cycles_per_op(benchmark::State &state) : m_state(state), m_start(read_cycles()) { }
+		~c_cycles_per_op() {
+			m_state.counters["cycles/op"] = benchmark::Counter(static_cast<double>(read_cycles() - m_start),
+				benchmark::Counter::kAvgIterations);
+		}
+	private:
+		benchmark::State &m_state;
+		const uint64_t m_start;
+};
+
+/// A read from TUN as the generator makes it: struct tun_pi, IPv6, UDP, and test payload with this index
+std::vector<unsigned char> make_test_frame(size_t payload_size, uint32_t index) {
+	std::vector<unsigned char> frame(4 + 40 + 8 + payload_size, 'x');
+	unsigned char *pi = frame.data();
+	pi[0] = pi[1] = 0;
+	pi[2] = 0x86; pi[3] = 0xDD; // ETH_P_IPV6
+	unsigned char *ip = pi + 4;
+	const size_t udp_size = 8 + payload_size;
+	std::memset(ip, 0, 40);
+	ip[0] = 0x60;
+	ip[4] = static_cast<unsigned char>(udp_size >> 8);
+	ip[5] = static_cast<unsigned char>(udp_size);
+	ip[6] = IPPROTO_UDP;
+	ip[7] = 64;
+	ip[8] = 0xFD; ip[23] = 2; // fd00::2
+	ip[24] = 0xFD; ip[39] = 1; // fd00::1
+	unsigned char *udp = ip + 40;
+	udp[0] = 0x27; udp[1] = 0x10; // 10000
+	udp[2] = 0x27; udp[3] = 0x10;
+	udp[4] = static_cast<unsigned char>(udp_size >> 8);
+	udp[5] = static_cast<unsigned char>(udp_size);
+	udp[6] = udp[7] = 0;
+	unsigned char *payload = udp + 8;
+	std::memcpy(payload, c_generator::marker, sizeof(c_generator::marker));
+	for (int i = 0; i < 4; ++i) payload[3 + i] = static_cast<unsigned char>(index >> (8 * i));
+	std::memset(payload + 3 + 4, 0, 8); // no send time
+	const uint16_t checksum = get_udp_checksum(ip, 6, 40, udp_size);
+	std::memcpy(udp + 6, &checksum, sizeof(checksum));
+	return frame;
+}
+
+// === counter
+
+void counter_tick(benchmark::State &state) {
+	c_counter counter(std::chrono::seconds(1), true);
+	std::ostringstream out; // silent ticks do not print, but one could
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) {
+		counter.add(1, 1500);
+		benchmark::DoNotOptimize(counter.tick(out, true));
+	}
+}
+BENCHMARK(counter_tick);
+
+// === packet check
+
+/// index of packet number i for each arrival pattern
+enum t_pattern { pattern_in_order, pattern_reordered, pattern_duplicate };
+
+void packet_check_see_packet(benchmark::State &state) {
+	const auto pattern = static_cast<t_pattern>(state.range(0));
+	std::streambuf *cout_buf = std::cout.rdbuf(nullptr); // mute the warnings about duplicates
+	c_packet_check packet_check(64 * 1024);
+	uint64_t i = 0;
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) {
+		uint64_t index = i;
+		if (pattern == pattern_reordered) index = i ^ 1; // every pair swapped
+		else if (pattern == pattern_duplicate) index = i / 2; // every packet twice
+		packet_check.see_packet(index);
+		++i;
+	}
+	std::cout.rdbuf(cout_buf);
+	std::cout.clear();
+	state.SetLabel(pattern == pattern_in_order ? "in-order" : (pattern == pattern_reordered ? "reordered" : "duplicate"));
+}
+BENCHMARK(packet_check_see_packet)->Arg(pattern_in_order)->Arg(pattern_reordered)->Arg(pattern_duplicate);
+
+/// a jump of more then the whole window after a partly seen one (a burst lost, or the sender restarted): only the
+/// packets not seen in the old window, and all between it and the new window, are lost; checked on each iteration
+void packet_check_window_jump(benchmark::State &state) {
+	// window 1000 is 32 words of 56 indexes; index 100000 is in word 1785, so the new window starts at word 1754
+	const uint64_t seen = 200, jump_to = 100000, expected_lost = 1754 * 56 - seen;
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) {
+		c_packet_check packet_check(1000);
+		for (uint64_t index = 0; index < seen; ++index) packet_check.see_packet(index);
+		packet_check.see_packet(jump_to);
+		if (packet_check.get_count_lost() != expected_lost) {
+			state.SkipWithError("packets seen before the jump counted as lost");
+			break;
+		}
+	}
+}
+BENCHMARK(packet_check_window_jump);
+
+// === marker and index of test packet, as the receiver gets them from a read
+
+void extract_index(benchmark::State &state) {
+	const auto frame = make_test_frame(state.range(0), 12345);
+	c_packet_check packet_check(64 * 1024);
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) {
+		const c_ip_packet packet(frame.data() + 4, frame.size() - 4);
+		uint64_t index = 0;
+		if (packet.is_udp()) {
+			const unsigned char *payload = packet.get_udp_payload();
+			if ((packet.get_udp_payload_size() >= 3 + 4) && (std::memcmp(payload, c_generator::marker, 3) == 0)) {
+				uint32_t index_low = 0;
+				for (int i = 0; i < 4; ++i) index_low += static_cast<uint32_t>(payload[3 + i]) << (8 * i);
+				index = packet_check.unwrap_index(index_low);
+			}
+		}
+		benchmark::DoNotOptimize(index);
+	}
+}
+BENCHMARK(extract_index)->Arg(64)->Arg(1400);
+
+/// search of the marker, for packets of unknown layout; the marker is at the end, so the whole frame is searched
+void find_marker_in_frame(benchmark::State &state) {
+	std::vector<unsigned char> data(state.range(0), 'x');
+	std::memcpy(&data.at(data.size() - 3), c_generator::marker, 3);
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) benchmark::DoNotOptimize(find_marker(data.data(), data.size(), c_generator::marker));
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(find_marker_in_frame)->Arg(64)->Arg(1500)->Arg(9000);
+
+// === integrity check and transform of payload
+
+void udp_checksum(benchmark::State &state) {
+	const auto frame = make_test_frame(state.range(0), 1);
+	const c_ip_packet packet(frame.data() + 4, frame.size() - 4);
+	c_packet_verify verify;
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) verify.see_udp_packet(packet);
+	state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(udp_checksum)->Arg(64)->Arg(1400)->Arg(9000);
+
+void transform_apply(benchmark::State &state, const char *name) {
+	const auto transform = make_transform(name, "tuntest");
+	std::vector<unsigned char> data(state.range(0), 'x');
+	uint64_t nonce = 0;
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) {
+		transform->apply(data.data(), data.data(), data.size(), nonce++);
+		benchmark::ClobberMemory();
+	}
+	state.SetBytesProcessed(state.iterations() * data.size());
+	state.SetLabel(transform->get_name());
+}
+BENCHMARK_CAPTURE(transform_apply, xor, "xor")->Arg(1400);
+BENCHMARK_CAPTURE(transform_apply, chacha20_scalar, "chacha20-scalar")->Arg(1400);
+BENCHMARK_CAPTURE(transform_apply, chacha20, "chacha20")->Arg(1400);
+
+/// what capturing adds to each packet of a reader: copy of the headers into the ring (the writer thread runs meanwhile;
+/// packets come here much faster than from a TUN, so dropped shows the share the writer could not keep up with)
+void capture_see_packet(benchmark::State &state) {
+	const auto frame = make_test_frame(1400, 0);
+	const std::string path = "/tmp/tun_test_bench_" + std::to_string(getpid()) + ".pcap";
+	size_t dropped = 0;
+	{
+		c_pcap_capture capture(path, 64 * 1024 * 1024, state.range(0));
+		c_cycles_per_op cycles(state);
+		for (auto _ : state) capture.see_packet(frame.data() + 4, frame.size() - 4);
+		capture.stop();
+		dropped = capture.get_count_dropped();
+	}
+	state.counters["dropped"] = benchmark::Counter(static_cast<double>(dropped), benchmark::Counter::kAvgIterations);
+	unlink(path.c_str());
+	unlink((path + ".1").c_str());
+}
+BENCHMARK(capture_see_packet)->Arg(0)->Arg(1500);
+
+// === buffers and reads
+
+void buffer_recycle(benchmark::State &state) {
+	c_buffer_pool pool(2048, 64);
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) {
+		unsigned char *buffer = pool.acquire();
+		benchmark::DoNotOptimize(buffer);
+		pool.release(buffer);
+	}
+}
+BENCHMARK(buffer_recycle);
+
+/// closes the descriptor and runs the aborted completion of its pending read (if any), so that no operation outlives
+/// the handler, loop and buffer it uses (they are declared after the io_service, so destroyed before it)
+void close_and_drain(boost::asio::posix::stream_descriptor &descriptor, boost::asio::io_service &io_service) {
+	descriptor.close();
+	io_service.restart();
+	io_service.run();
+}
+
+/// one packet through the loopback backend: written into the source end of socketpair, then async_read_some of
+/// the read end completes in io_service::run_one() on this thread (so no thread handoff is in the number)
+void loopback_async_read(benchmark::State &state) {
+	c_loopback_pairs pairs(1);
+	boost::asio::io_service io_service;
+	boost::asio::posix::stream_descriptor descriptor(io_service, pairs.m_read_fds.at(0)); // takes ownership of the read fd
+	const auto frame = make_test_frame(state.range(0), 0);
+	c_buffer_pool pool(64 * 1024, 1);
+	unsigned char *buffer = pool.acquire();
+	size_t bytes_read = 0;
+	c_cycles_per_op cycles(state);
+	for (auto _ : state) {
+		if (write(pairs.m_source_fds.at(0), frame.data(), frame.size()) != static_cast<ssize_t>(frame.size())) {
+			state.SkipWithError("write to loopback failed");
+			break;
+		}
+		descriptor.async_read_some(boost::asio::buffer(buffer, pool.get_buffer_size()),
+			[&bytes_read](const boost::system::error_code &error, size_t bytes_transferred) {
+				if (!error) bytes_read += bytes_transferred;
+			});
+		io_service.run_one();
+		io_service.restart();
+	}
+	if (bytes_read != state.iterations() * frame.size()) state.SkipWithError("loopback lost data");
+	close_and_drain(descriptor, io_service);
+	pool.release(buffer);
+}
+BENCHMARK(loopback_async_read)->Arg(64)->Arg(1400);
+
+/// the asio read loop of main, re-armed from its completion: mallocs/op must be 0 for c_read_loop;
+/// the std::function variant is how it was done before (a copy of the std::function for each read)
+void read_loop_mallocs(benchmark::State &state, bool std_function) {
+	c_loopback_pairs pairs(1);
+	boost::asio::io_service io_service;
+	boost::asio::posix::stream_descriptor descriptor(io_service, pairs.m_read_fds.at(0)); // takes ownership of the read fd
+	const auto frame = make_test_frame(1400, 0);
+	c_buffer_pool pool(64 * 1024, 1);
+	unsigned char *buffer = pool.acquire();
+	size_t bytes_read = 0;
+	auto on_packet = [&bytes_read](const unsigned char *, size_t size) { bytes_read += size; };
+	c_read_loop read_loop(descriptor, buffer, pool.get_buffer_size(), on_packet);
+	std::function<void(const boost::system::error_code &, size_t)> read_handler = [&](const boost::system::error_code &error,
+		size_t bytes_transferred) {
+		if (error) return;
+		on_packet(buffer, bytes_transferred);
+		descriptor.async_read_some(boost::asio::buffer(buffer, pool.get_buffer_size()), read_handler);
+	};
+	if (std_function) descriptor.async_read_some(boost::asio::buffer(buffer, pool.get_buffer_size()), read_handler);
+	else read_loop.start();
+
+	const size_t mallocs_before = count_mallocs.load();
+	for (auto _ : state) {
+		if (write(pairs.m_source_fds.at(0), frame.data(), frame.size()) != static_cast<ssize_t>(frame.size())) {
+			state.SkipWithError("write to loopback failed");
+			break;
+		}
+		io_service.run_one();
+	}
+	state.counters["mallocs/op"] = benchmark::Counter(static_cast<double>(count_mallocs.load() - mallocs_before),
+		benchmark::Counter::kAvgIterations);
+	if (bytes_read != state.iterations() * frame.size()) state.SkipWithError("loopback lost data");
+	if (!std_function) state.counters["heap_fallbacks"] = static_cast<double>(read_loop.get_count_heap_allocations());
+	close_and_drain(descriptor, io_service);
+	pool.release(buffer);
+}
+BENCHMARK_CAPTURE(read_loop_mallocs, read_loop, false);
+BENCHMARK_CAPTURE(read_loop_mallocs, std_function, true);
+
+} // namespace
+
+int main(int argc, char **argv) {
+	check_cpu_for_build();
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include "buffer_pool.hpp"
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+c_buffer_pool::c_buffer_pool(size_t buffer_size, size_t number_of_buffers, int numa_node)
+	: m_buffer_size(buffer_size),
+	m_stride( (buffer_size + cache_line_size - 1) / cache_line_size * cache_line_size ),
+	m_slab(nullptr), m_numa_size(0)
+{
+	if (number_of_buffers < 1) throw std::invalid_argument("buffer pool needs at least 1 buffer");
+	void *slab = nullptr;
+#ifdef HAVE_LIBNUMA
+	if ((numa_node >= 0) && (numa_available() >= 0)) { // page aligned, so also cache line aligned
+		slab = numa_alloc_onnode(m_stride * number_of_buffers, numa_node);
+		if (slab == nullptr) throw std::bad_alloc();
+		m_numa_size = m_stride * number_of_buffers;
+	}
+#else
+	(void)numa_node; // without libnuma the pages land where they are first touched, usually by the reading thread
+#endif
+	if ((slab == nullptr) && (posix_memalign(&slab, cache_line_size, m_stride * number_of_buffers) != 0)) throw std::bad_alloc();
+	m_slab = static_cast<unsigned char *>(slab);
+
+	m_free.reserve(number_of_buffers);
+	for (size_t i = number_of_buffers; i > 0; --i) m_free.push_back(m_slab + (i - 1) * m_stride); // buffer 0 is on top
+}
+
+c_buffer_pool::~c_buffer_pool() {
+#ifdef HAVE_LIBNUMA
+	if (m_numa_size) {
+		numa_free(m_slab, m_numa_size);
+		return;
+	}
+#endif
+	free(m_slab);
+}
+
+unsigned char *c_buffer_pool::acquire() {
+	if (m_free.empty()) return nullptr;
+	unsigned char *buffer = m_free.back();
+	m_free.pop_back();
+	return buffer;
+}
+
+void c_buffer_pool::release(unsigned char *buffer) {
+	if (m_free.size() == m_free.capacity()) throw std::logic_error("buffer released to pool more times then acquired");
+	m_free.push_back(buffer); // never reallocates, capacity was reserved for all buffers
+}
+
+size_t c_buffer_pool::get_buffer_size() const {
+	return m_buffer_size;
+}
+
+size_t c_buffer_pool::get_number_free() const {
+	return m_free.size();
+}
+
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/// Pool of equal-sized buffers, each starting on its own cache line, all allocated once up front.
+/// Buffers are recycled by acquire()/release() without any heap allocation.
+/// Not thread-safe: take the buffers before starting the threads, or give each thread own pool.
+class c_buffer_pool final {
+	public:
+		static constexpr size_t cache_line_size = 64;
+
+		/// numa_node - allocate the memory on this NUMA node (e.g. of the CPU of the thread using the buffers), -1 for default
+		c_buffer_pool(size_t buffer_size, size_t number_of_buffers, int numa_node = -1);
+		~c_buffer_pool();
+		c_buffer_pool(const c_buffer_pool &) = delete;
+		c_buffer_pool &operator=(const c_buffer_pool &) = delete;
+
+		unsigned char *acquire(); ///< take a free buffer (of get_buffer_size() bytes); nullptr if all are taken
+		void release(unsigned char *buffer); ///< give back a buffer that was taken by acquire()
+
+		size_t get_buffer_size() const; ///< usable size of each buffer
+		size_t get_number_free() const; ///< how many buffers can be acquired now
+
+	private:
+		const size_t m_buffer_size; ///< usable size of each buffer
+		const size_t m_stride; ///< distance between buffers, m_buffer_size rounded up to whole cache lines
+		unsigned char *m_slab; ///< one allocation holding all the buffers
+		size_t m_numa_size; ///< size of m_slab if it was allocated on a NUMA node, else 0
+		std::vector<unsigned char *> m_free; ///< stack of free buffers, capacity reserved for all of them
+};
+
@@ -0,0 +1,72 @@
+#include "busy_poll_rx.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace {
+void cpu_relax() { ///< tell the CPU we spin (saves power, and the sibling hyperthread gets the core)
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#endif
+}
+}
+
+constexpr size_t c_busy_poll_rx::yield_reads;
+
+c_busy_poll_rx::c_busy_poll_rx(int fd, size_t buffer_size, size_t spin_reads, t_packet_handler handler, int numa_node)
+	: m_fd(fd), m_spin_reads(spin_reads), m_handler(handler), m_buffer_pool(buffer_size, 1, numa_node),
+	m_buffer(m_buffer_pool.acquire()),
+	m_count_packets(0), m_count_empty_reads(0), m_count_sleeps(0)
+{
+	fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+}
+
+void c_busy_poll_rx::run(const std::atomic<bool> &stop) {
+	const int poll_timeout_ms = 100; // how fast we notice the stop flag while idle
+	pollfd poll_fd;
+	poll_fd.fd = m_fd;
+	poll_fd.events = POLLIN;
+	size_t empty_reads = 0; // in a row, since the last packet
+	while (!stop.load(std::memory_order_relaxed)) {
+		const ssize_t size = read(m_fd, m_buffer, m_buffer_pool.get_buffer_size());
+		if (size > 0) {
+			++m_count_packets;
+			empty_reads = 0;
+			m_handler(m_buffer, static_cast<size_t>(size));
+			continue;
+		}
+		if ((size < 0) && (errno != EAGAIN) && (errno != EINTR))
+			throw std::runtime_error(std::string("busy poll read: ") + strerror(errno));
+
+		++m_count_empty_reads;
+		++empty_reads;
+		if (empty_reads <= m_spin_reads) cpu_relax();
+		else if (empty_reads <= m_spin_reads + yield_reads) sched_yield();
+		else {
+			++m_count_sleeps;
+			// idle: the next packet pays the wakeup, and we spin again after it; on timeout we stay asleep
+			if (poll(&poll_fd, 1, poll_timeout_ms) > 0) empty_reads = 0;
+		}
+	}
+}
+
+size_t c_busy_poll_rx::get_count_packets() const {
+	return m_count_packets;
+}
+
+size_t c_busy_poll_rx::get_count_empty_reads() const {
+	return m_count_empty_reads;
+}
+
+size_t c_busy_poll_rx::get_count_sleeps() const {
+	return m_count_sleeps;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include "buffer_pool.hpp"
+
+/// Receive engine for the lowest latency: non-blocking read() of one fd in a tight loop, no reactor and no wakeup
+/// between packets. When reads find nothing it backs off in steps: spins with a CPU pause, then yields the CPU,
+/// then sleeps in poll() until the fd is readable. Meant for a pinned thread that may burn its core.
+/// One object is used by one thread.
+class c_busy_poll_rx final {
+	public:
+		using t_packet_handler = std::function<void(const unsigned char *data, size_t size)>;
+
+		/// spin_reads - how many empty reads to spin before yielding and then sleeping in poll(); numa_node - of the buffer
+		c_busy_poll_rx(int fd, size_t buffer_size, size_t spin_reads, t_packet_handler handler, int numa_node = -1);
+		c_busy_poll_rx(const c_busy_poll_rx &) = delete;
+		c_busy_poll_rx &operator=(const c_busy_poll_rx &) = delete;
+
+		/// read packets and call handler for them, until stop is set; throws std::runtime_error if a read fails
+		void run(const std::atomic<bool> &stop);
+
+		size_t get_count_packets() const; ///< how many packets were read
+		size_t get_count_empty_reads() const; ///< reads that found nothing (the price of spinning)
+		size_t get_count_sleeps() const; ///< how many times it went idle into poll()
+
+	private:
+		static constexpr size_t yield_reads = 16; ///< after spinning, how many empty reads with sched_yield() before poll()
+
+		const int m_fd; ///< the fd we read from
+		const size_t m_spin_reads;
+		t_packet_handler m_handler;
+		c_buffer_pool m_buffer_pool;
+		unsigned char *m_buffer;
+
+		size_t m_count_packets;
+		size_t m_count_empty_reads;
+		size_t m_count_sleeps;
+};
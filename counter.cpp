@@ -4,9 +4,9 @@
 
 c_counter::c_counter(c_counter::t_duration tick_len, bool is_main)
 	: m_tick_len(tick_len), m_is_main(is_main),
-	m_pck_all(0), m_pck_w(0), m_bytes_all(0), m_bytes_w(0)
+	m_pck_all(0), m_pck_w(0), m_bytes_all(0), m_bytes_w(0), m_started(false)
 {
-	m_time_first = m_time_ws = time_now();
+	m_time_first = m_time_ws = m_time_last = time_now();
 }
 
 std::chrono::steady_clock::time_point c_counter::time_now() {
@@ -23,10 +23,13 @@ c_counter::t_count c_counter::get_pck_all() const { ///< read all packets count
 c_counter::t_count c_counter::get_bytes_all() const { ///< read all packets bytes
 	return m_bytes_all;
 }
+double c_counter::get_time_all() const {
+	return time_to_second(m_time_last - m_time_first);
+}
 
-void c_counter::add(c_counter::t_count bytes) { ///< general type for integrals (number of packets, of bytes)
-	m_pck_all += 1;
-	m_pck_w += 1;
+void c_counter::add(c_counter::t_count packets, c_counter::t_count bytes) {
+	m_pck_all += packets;
+	m_pck_w += packets;
 
 	m_bytes_all += bytes;
 	m_bytes_w += bytes;
@@ -37,25 +40,24 @@ void c_counter::reset_time() {
 	m_time_ws = m_time_last = time_now();
 }
 
-bool c_counter::tick(c_counter::t_count bytes, std::ostream &out, bool silent) {
-	add(bytes);
-
+bool c_counter::tick(std::ostream &out, bool silent) {
 	bool do_print=0;
 	bool do_reset=0;
-	if (m_pck_all==1) { // first packet
-		do_print=1; do_reset=1;
-
-		m_time_first = time_now(); // and other times in reset
-	}
-	if (0 == (m_pck_all%(1000*10))) {
-		// std::cerr<<m_bytes_all<<std::endl; std::cout << m_time_last << " >? " << m_time_ws << std::endl;
-		m_time_last = time_now();
-		if (m_time_last >= m_time_ws + m_tick_len) { do_reset=1; do_print=1; }
+	if (!m_started) {
+		if (m_pck_all==0) { // nothing yet, idle time is not counted
+			m_time_first = m_time_ws = m_time_last = time_now();
+			return false;
+		}
+		m_started=true; // first packets, they came after the previous tick (m_time_last)
+		m_time_first = m_time_ws = m_time_last;
+		do_print=1;
 	}
+	m_time_last = time_now();
+	if (m_time_last >= m_time_ws + m_tick_len) { do_reset=1; do_print=1; }
 	if (silent) do_print=false;
 	if (do_print) print(out);
 	if (do_reset) {
-		m_time_ws = m_time_last = time_now();
+		m_time_ws = m_time_last;
 		m_pck_w=0;
 		m_bytes_w=0;
 	}
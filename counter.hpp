@@ -10,8 +10,8 @@ class c_counter {
 
 		c_counter(c_counter::t_duration tick_len, bool is_main); ///< tick_len - how often should we fire (print stats, and restart window)
 
-		void add(c_counter::t_count bytes); ///< general type for integrals (number of packets, of bytes)
-		bool tick(c_counter::t_count bytes, std::ostream &out, bool silent=false); ///< tick: add data; update clock; print; return - was print used
+		void add(c_counter::t_count packets, c_counter::t_count bytes); ///< add data that arrived (since last add)
+		bool tick(std::ostream &out, bool silent=false); ///< tick: update clock; print and restart window if it passed; return - was print used
 
 		void reset_time(); ///< resets the time to current clock (but keeps number of bytes)
 
@@ -19,6 +19,7 @@ class c_counter {
 
 		t_count get_pck_all() const; ///< read all packets count
 		t_count get_bytes_all() const; ///< read all bytes count
+		double get_time_all() const; ///< seconds from the first data to the last tick
 
 	private:
 		const t_duration m_tick_len; ///< how often should I tick - it's both the window size, and the rate of e.g. print()
@@ -31,6 +32,7 @@ class c_counter {
 		t_timepoint m_time_first; ///< when I was started at first actually
 		t_timepoint m_time_ws; ///< window stared time
 		t_timepoint m_time_last; ///< current last time
+		bool m_started; ///< did any data arrive yet (the time is counted from the tick before first data)
 
 		static std::chrono::steady_clock::time_point time_now();
 		static double time_to_second(std::chrono::steady_clock::duration dur);
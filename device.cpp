@@ -0,0 +1,328 @@
+#include "device.hpp"
+#include "NetPlatform.h"
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+template <typename T> void memzero(const T & obj) {
+	std::memset( (void*) & obj , 0 , sizeof(T) );
+}
+
+template <typename T>
+class as_zerofill : public T {
+	public:
+		as_zerofill() {
+			assert( sizeof(*this) == sizeof(T) ); // TODO move to static assert. sanity check. quote isostd
+			void* baseptr = static_cast<void*>( dynamic_cast<T*>(this) );
+			assert(baseptr == this); // TODO quote isostd
+			memset( baseptr , 0 , sizeof(T) );
+		}
+		T& get() { return *this; }
+};
+
+void throw_if_error(t_syserr result, const std::string &what) {
+	if (result.my_code < 0) throw std::runtime_error(what + ": error " + std::to_string(result.my_code)
+		+ (result.errno_copy ? std::string(" ") + strerror(result.errno_copy) : std::string()));
+}
+
+} // namespace
+
+/******************************************************************/
+
+c_tun_queue_stats::c_counts::c_counts()
+	: m_bytes(0), m_packets(0), m_segments(0)
+{ }
+
+c_tun_queue_stats::c_tun_queue_stats() = default;
+
+void c_tun_queue_stats::add_packet(size_t bytes, size_t segments) {
+	c_counts & counts = m_counts.local(); // we are the only writer of it: plain load and store
+	counts.m_bytes.store(counts.m_bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+	counts.m_packets.store(counts.m_packets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	counts.m_segments.store(counts.m_segments.load(std::memory_order_relaxed) + segments, std::memory_order_relaxed);
+}
+
+c_tun_queue_stats::c_totals c_tun_queue_stats::get_totals() const {
+	c_totals sum{ 0, 0, 0 };
+	m_counts.for_each([&sum](const c_counts & counts) {
+		sum.m_bytes += counts.m_bytes.load(std::memory_order_relaxed);
+		sum.m_packets += counts.m_packets.load(std::memory_order_relaxed);
+		sum.m_segments += counts.m_segments.load(std::memory_order_relaxed);
+	});
+	return sum;
+}
+
+/******************************************************************/
+
+c_io_service_pool::c_io_service_pool(size_t number_of_threads, const c_thread_placement &placement)
+	:
+		m_idle_work(new boost::asio::io_service::work(m_io_service))
+{
+	if (number_of_threads < 1) throw std::invalid_argument("io_service pool needs at least 1 thread");
+	for (size_t thread_nr = 0; thread_nr < number_of_threads; thread_nr++)
+		m_threads.emplace_back([this, placement, thread_nr] {
+			std::cout << "start asio pool thread\n";
+			placement.apply(thread_nr);
+			m_io_service.run();
+		});
+}
+
+c_io_service_pool::~c_io_service_pool() {
+	stop();
+}
+
+boost::asio::io_service &c_io_service_pool::get_io_service() {
+	return m_io_service;
+}
+
+size_t c_io_service_pool::get_number_of_threads() const {
+	return m_threads.size();
+}
+
+void c_io_service_pool::stop() {
+	m_io_service.stop();
+	for (auto & thread : m_threads)
+		if (thread.joinable()) thread.join();
+}
+
+/******************************************************************/
+
+c_device_asio::c_device_asio(std::vector<int> fds, size_t number_of_threads, bool io_service_per_queue,
+	const c_thread_placement &placement)
+	:
+		m_fds(fds),
+		m_queue_stats(fds.size())
+{
+	const size_t number_of_queues = m_fds.size();
+	const size_t number_of_io_services = io_service_per_queue ? number_of_queues : 1;
+	for (size_t i = 0; i < number_of_io_services; i++) {
+		m_io_services.emplace_back(new boost::asio::io_service);
+		m_idle_works.emplace_back(new boost::asio::io_service::work(*m_io_services.back()));
+	}
+	for (size_t i = 0; i < number_of_queues; i++) {
+		auto &io_service = *m_io_services.at(io_service_per_queue ? i : 0);
+		m_handlers.emplace_back(new boost::asio::posix::stream_descriptor(io_service, m_fds.at(i)));
+		if (!m_handlers.back()->is_open()) throw std::runtime_error("device queue is not open");
+	}
+
+	const size_t threads_per_io_service = io_service_per_queue ? 1 : number_of_threads;
+	for (auto & io_service : m_io_services)
+		for (size_t i = 0; i < threads_per_io_service; i++) {
+			const size_t thread_nr = m_io_service_threads.size();
+			m_io_service_threads.emplace_back([&io_service, placement, thread_nr] {
+				std::cout << "start asio thread\n";
+				placement.apply(thread_nr);
+				io_service->run();
+			});
+		}
+}
+
+c_device_asio::c_device_asio(std::vector<int> fds, c_io_service_pool &pool)
+	:
+		m_fds(fds),
+		m_queue_stats(fds.size())
+{
+	for (int fd : m_fds) {
+		m_handlers.emplace_back(new boost::asio::posix::stream_descriptor(pool.get_io_service(), fd));
+		if (!m_handlers.back()->is_open()) throw std::runtime_error("device queue is not open");
+	}
+}
+
+c_device_asio::~c_device_asio() {
+	stop();
+}
+
+void c_device_asio::stop() {
+	for (auto & io_service : m_io_services)
+		io_service->stop();
+	for (auto & thread : m_io_service_threads)
+		if (thread.joinable()) thread.join();
+}
+
+void c_device_asio::reassign_descriptors() {
+	for (size_t i = 0; i < m_fds.size(); i++) {
+		m_handlers.at(i)->release();
+		m_handlers.at(i)->assign(m_fds.at(i));
+	}
+}
+
+int c_device_asio::get_source_fd(size_t) const {
+	return -1;
+}
+
+size_t c_device_asio::get_number_of_queues() const {
+	return m_fds.size();
+}
+
+boost::asio::posix::stream_descriptor &c_device_asio::get_stream_descriptor(size_t queue_nr) {
+	return *m_handlers.at(queue_nr);
+}
+
+c_tun_queue_stats &c_device_asio::get_queue_stats(size_t queue_nr) {
+	return m_queue_stats.at(queue_nr);
+}
+
+void c_device_asio::print_queue_stats(std::ostream &out) const {
+	for (size_t i = 0; i < m_queue_stats.size(); i++) {
+		const c_totals stats = m_queue_stats.at(i).get_totals();
+		out << "Queue " << i << ": " << stats.m_packets << " pck; " << stats.m_segments << " segments; "
+			<< stats.m_bytes << " bytes\n";
+	}
+	const c_totals totals = get_stats_totals();
+	out << "All queues: " << totals.m_packets << " pck; " << totals.m_segments << " segments; " << totals.m_bytes << " bytes"
+		<< std::endl;
+}
+
+c_device_asio::c_totals c_device_asio::get_stats_totals() const {
+	c_totals totals = { 0, 0, 0 };
+	for (const auto & stats : m_queue_stats) {
+		const c_totals queue = stats.get_totals();
+		totals.m_bytes += queue.m_bytes;
+		totals.m_packets += queue.m_packets;
+		totals.m_segments += queue.m_segments;
+	}
+	return totals;
+}
+
+/******************************************************************/
+
+std::vector<int> c_tun_device_linux_asio::open_queues(size_t number_of_queues) {
+	if (number_of_queues < 1) throw std::invalid_argument("TUN needs at least 1 queue");
+	std::vector<int> fds;
+	for (size_t i = 0; i < number_of_queues; i++) {
+		int fd = open("/dev/net/tun", O_RDWR);
+		if (fd < 0) {
+			for (int opened : fds) close(opened);
+			throw std::runtime_error("can not open /dev/net/tun");
+		}
+		fds.push_back(fd);
+	}
+	return fds;
+}
+
+c_tun_device_linux_asio::c_tun_device_linux_asio(size_t number_of_threads, size_t number_of_queues, bool io_service_per_queue,
+	bool offload, const c_thread_placement &placement)
+	:
+		c_device_asio(open_queues(number_of_queues), number_of_threads, io_service_per_queue, placement),
+		m_offload(offload)
+{ }
+
+c_tun_device_linux_asio::c_tun_device_linux_asio(c_io_service_pool &pool, size_t number_of_queues, bool offload)
+	:
+		c_device_asio(open_queues(number_of_queues), pool),
+		m_offload(offload)
+{ }
+
+void c_tun_device_linux_asio::create_interface() {
+	as_zerofill< ifreq > ifr; // the if request
+	ifr.ifr_flags = IFF_TUN;
+	if (m_fds.size() > 1) ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	if (m_offload) ifr.ifr_flags |= IFF_VNET_HDR;
+	strncpy(ifr.ifr_name, "galaxy%d", IFNAMSIZ);
+	for (size_t i = 0; i < m_fds.size(); i++) {
+		// the first ioctl resolves the name, next queues attach to the same interface by this name
+		auto errcode_ioctl =  ioctl(m_fds.at(i), TUNSETIFF, static_cast<void *>(&ifr));
+		if (errcode_ioctl < 0) throw std::runtime_error("ioctl error");
+	}
+	reassign_descriptors();
+	if (m_offload) {
+		// kernel can then give us GSO super-packets (TCP and UDP), with checksums not yet computed
+		const unsigned int offload_tcp = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+		const unsigned int offload_udp = 0x20 | 0x40; // TUN_F_USO4 | TUN_F_USO6, linux 6.2+
+		if (ioctl(m_fds.at(0), TUNSETOFFLOAD, offload_tcp | offload_udp) < 0) {
+			std::cout << "kernel has no UDP segmentation offload for TUN, using only TSO\n";
+			if (ioctl(m_fds.at(0), TUNSETOFFLOAD, offload_tcp) < 0) throw std::runtime_error("ioctl TUNSETOFFLOAD error");
+		}
+	}
+	m_ifname = ifr.ifr_name;
+}
+
+void c_tun_device_linux_asio::set_ipv6(const std::array<uint8_t, 16> &binary_address, int prefixLen, uint32_t mtu) {
+	std::cout << "IFNAMSIZ " << IFNAMSIZ << '\n';
+	create_interface();
+	std::cout << "iface name " << m_ifname << " queues " << m_fds.size() << '\n';
+	// up, MTU and address in one netlink batch
+	const NetPlatform_ifConfig config{ m_ifname.c_str(), binary_address.data(), prefixLen, Sockaddr_AF_INET6, mtu };
+	throw_if_error(NetPlatform_configureInterfaces(&config, 1), "can not configure " + m_ifname);
+}
+
+void c_tun_device_linux_asio::set_ipv6_all(const std::vector<c_tun_device_linux_asio *> &devices,
+	const std::vector<std::array<uint8_t, 16>> &binary_addresses, int prefixLen, uint32_t mtu)
+{
+	if (binary_addresses.size() != devices.size()) throw std::invalid_argument("set_ipv6_all needs an address for each device");
+	std::vector<NetPlatform_ifConfig> configs;
+	for (size_t i = 0; i < devices.size(); i++) {
+		devices.at(i)->create_interface();
+		configs.push_back({ devices.at(i)->m_ifname.c_str(), binary_addresses.at(i).data(), prefixLen, Sockaddr_AF_INET6, mtu });
+	}
+	if (devices.empty()) return;
+	std::cout << "ifaces " << devices.front()->m_ifname << " .. " << devices.back()->m_ifname << " ("
+		<< devices.size() << ") queues " << devices.front()->m_fds.size() << '\n';
+	throw_if_error(NetPlatform_configureInterfaces(configs.data(), static_cast<int>(configs.size())), "can not configure ifaces");
+}
+
+const std::string &c_tun_device_linux_asio::get_ifname() const {
+	return m_ifname;
+}
+
+void c_tun_device_linux_asio::add_ipv4(const std::array<uint8_t, 4> &binary_address, int prefixLen) {
+	if (m_ifname.empty()) throw std::logic_error("add_ipv4 before set_ipv6");
+	throw_if_error(NetPlatform_addAddress(m_ifname.c_str(), binary_address.data(), prefixLen, Sockaddr_AF_INET),
+		"can not add IPv4 address to " + m_ifname);
+}
+
+/******************************************************************/
+
+c_loopback_pairs::c_loopback_pairs(size_t number_of_queues) {
+	if (number_of_queues < 1) throw std::invalid_argument("loopback device needs at least 1 queue");
+	for (size_t i = 0; i < number_of_queues; i++) {
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) < 0) {
+			for (int opened : m_read_fds) close(opened);
+			for (int opened : m_source_fds) close(opened);
+			throw std::runtime_error("can not open socketpair for loopback device");
+		}
+		const int buffer_size = 4 * 1024 * 1024; // like the TUN queue, hold some packets when reader is late
+		setsockopt(pair[0], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+		setsockopt(pair[1], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+		m_read_fds.push_back(pair[0]);
+		m_source_fds.push_back(pair[1]);
+	}
+}
+
+c_loopback_pairs::~c_loopback_pairs() {
+	for (int fd : m_source_fds) close(fd);
+}
+
+c_loopback_device_asio::c_loopback_device_asio(size_t number_of_threads, size_t number_of_queues, bool io_service_per_queue,
+	const c_thread_placement &placement)
+	:
+		c_loopback_pairs(number_of_queues),
+		c_device_asio(m_read_fds, number_of_threads, io_service_per_queue, placement)
+{ }
+
+c_loopback_device_asio::c_loopback_device_asio(c_io_service_pool &pool, size_t number_of_queues)
+	:
+		c_loopback_pairs(number_of_queues),
+		c_device_asio(m_read_fds, pool)
+{ }
+
+void c_loopback_device_asio::set_ipv6(const std::array<uint8_t, 16> &, int, uint32_t mtu) {
+	std::cout << "loopback device, queues " << m_fds.size() << " (no address to set, mtu " << mtu << " not enforced)\n";
+}
+
+void c_loopback_device_asio::add_ipv4(const std::array<uint8_t, 4> &, int) {
+}
+
+int c_loopback_device_asio::get_source_fd(size_t queue_nr) const {
+	return m_source_fds.at(queue_nr);
+}
+
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "thread_placement.hpp"
+#include "thread_slots.hpp"
+
+/// Statistics of one device queue, read by the reporter. Each thread that reads the queue (asio threads of its read
+/// loops, or the one busy-poll / io_uring reader) counts into own slot, so they never contend on it, whatever their number.
+class c_tun_queue_stats final {
+	public:
+		c_tun_queue_stats();
+		void add_packet(size_t bytes, size_t segments); ///< count packet read by the calling thread
+
+		/// the counters, summed from all threads
+		struct c_totals {
+			size_t m_bytes; ///< all bytes read from this queue
+			size_t m_packets; ///< all packets read from this queue
+			size_t m_segments; ///< all packets on the wire, counting each segment of GSO super-packets
+		};
+		c_totals get_totals() const;
+
+	private:
+		/// counters of one thread
+		struct c_counts {
+			c_counts();
+			std::atomic<size_t> m_bytes;
+			std::atomic<size_t> m_packets;
+			std::atomic<size_t> m_segments;
+		};
+		c_thread_slots<c_counts> m_counts;
+};
+
+/// One io_service run by a pool of threads, shared by many devices (instead of own io_service and threads in each device).
+/// One reactor then waits on the fds of all of them.
+class c_io_service_pool final {
+	public:
+		/// placement - CPU and scheduling of the threads
+		c_io_service_pool(size_t number_of_threads, const c_thread_placement &placement = c_thread_placement());
+		~c_io_service_pool(); ///< stop()
+		c_io_service_pool(const c_io_service_pool &) = delete;
+		c_io_service_pool &operator=(const c_io_service_pool &) = delete;
+
+		boost::asio::io_service &get_io_service();
+		size_t get_number_of_threads() const;
+		/// stops the io_service and joins the threads, handlers that did not run yet will not run;
+		/// call it before destroying what the handlers use
+		void stop();
+
+	private:
+		boost::asio::io_service m_io_service;
+		std::unique_ptr<boost::asio::io_service::work> m_idle_work; ///< keeps m_io_service running
+		std::vector<std::thread> m_threads;
+};
+
+/// A device we read packets from: one or more queues (fds), each with own stream_descriptor, run by asio threads.
+/// Reads give one packet each, starting with the struct tun_pi (and virtio_net_hdr if offload is used).
+class c_device_asio {
+	public:
+		virtual ~c_device_asio();
+		virtual void set_ipv6(const std::array<uint8_t, 16> &binary_address, int prefixLen, uint32_t mtu) = 0;
+		virtual void add_ipv4(const std::array<uint8_t, 4> &binary_address, int prefixLen) = 0; ///< call after set_ipv6
+		/// fd where packets can be written, to be then read from this queue; -1 if the device has no such fd
+		virtual int get_source_fd(size_t queue_nr) const;
+
+		size_t get_number_of_queues() const;
+		boost::asio::posix::stream_descriptor &get_stream_descriptor(size_t queue_nr = 0);
+		c_tun_queue_stats &get_queue_stats(size_t queue_nr = 0);
+		/// stops the own io_services of this device and joins their threads, handlers that did not run yet will not run;
+		/// call it before destroying what the handlers use (with a c_io_service_pool, stop the pool instead)
+		void stop();
+		void print_queue_stats(std::ostream &out) const; ///< prints stats of each queue, and all of them merged
+		using c_totals = c_tun_queue_stats::c_totals;
+		c_totals get_stats_totals() const; ///< stats of all queues summed
+
+	protected:
+		/// fds - already opened fd of each queue, we take ownership
+		/// io_service_per_queue - each queue gets own io_service and own thread (then number_of_threads is ignored)
+		/// placement - CPU and scheduling of the threads; with io_service_per_queue thread nr N serves queue N
+		c_device_asio(std::vector<int> fds, size_t number_of_threads, bool io_service_per_queue, const c_thread_placement &placement);
+		/// fds - as above; all queues are run by the threads of the pool (it must outlive this device)
+		c_device_asio(std::vector<int> fds, c_io_service_pool &pool);
+		void reassign_descriptors(); ///< re-register the fds in asio, e.g. after ioctl changed what they are
+
+		const std::vector<int> m_fds; ///< fd of each queue
+	private:
+		std::vector<std::unique_ptr<boost::asio::io_service>> m_io_services; ///< one shared by all queues, or one per queue; none with pool
+		std::vector<std::unique_ptr<boost::asio::io_service::work>> m_idle_works; ///< keeps each of m_io_services running
+		std::vector<std::unique_ptr<boost::asio::posix::stream_descriptor>> m_handlers; ///< one per queue
+		std::vector<c_tun_queue_stats> m_queue_stats; ///< one per queue
+		std::vector<std::thread> m_io_service_threads;
+};
+
+/// The linux TUN, with one or more queues (IFF_MULTI_QUEUE). Needs CAP_NET_ADMIN.
+class c_tun_device_linux_asio final : public c_device_asio {
+	public:
+		/// number_of_queues - how many TUN queues (fds) to open, more then 1 uses IFF_MULTI_QUEUE
+		/// offload - open with IFF_VNET_HDR and enable TSO/USO, then each read starts with virtio_net_hdr (after PI)
+		c_tun_device_linux_asio(size_t number_of_threads, size_t number_of_queues = 1, bool io_service_per_queue = false,
+			bool offload = false, const c_thread_placement &placement = c_thread_placement());
+		/// run by the threads of a pool shared with other devices
+		c_tun_device_linux_asio(c_io_service_pool &pool, size_t number_of_queues = 1, bool offload = false);
+		void set_ipv6(const std::array<uint8_t, 16> &binary_address, int prefixLen, uint32_t mtu) override;
+		void add_ipv4(const std::array<uint8_t, 4> &binary_address, int prefixLen) override;
+		/// set_ipv6 of each device, device nr i gets binary_addresses[i]; all are configured together in few netlink messages
+		static void set_ipv6_all(const std::vector<c_tun_device_linux_asio *> &devices,
+			const std::vector<std::array<uint8_t, 16>> &binary_addresses, int prefixLen, uint32_t mtu);
+		const std::string &get_ifname() const; ///< empty before set_ipv6
+	private:
+		const bool m_offload; ///< IFF_VNET_HDR and TUNSETOFFLOAD
+		std::string m_ifname; ///< name of the interface, known after set_ipv6
+
+		static std::vector<int> open_queues(size_t number_of_queues);
+		void create_interface(); ///< TUNSETIFF on all queues (kernel names it galaxyN), sets m_ifname
+};
+
+/// The socketpairs of c_loopback_device_asio. A base class of it, so they are opened before c_device_asio gets the reading ends
+struct c_loopback_pairs {
+	c_loopback_pairs(size_t number_of_queues);
+	~c_loopback_pairs(); ///< closes m_source_fds (m_read_fds are closed by their stream_descriptor)
+	std::vector<int> m_read_fds; ///< the end of socketpair of each queue that we read
+	std::vector<int> m_source_fds; ///< the other end of socketpair of each queue
+};
+
+/// In-process stand-in for the TUN, works without any privileges: each queue is a socketpair(SOCK_SEQPACKET),
+/// we read from one end, and a packet source (e.g. c_generator) writes the packets, in the TUN format, into the other.
+class c_loopback_device_asio final : private c_loopback_pairs, public c_device_asio {
+	public:
+		c_loopback_device_asio(size_t number_of_threads, size_t number_of_queues = 1, bool io_service_per_queue = false,
+			const c_thread_placement &placement = c_thread_placement());
+		/// run by the threads of a pool shared with other devices
+		c_loopback_device_asio(c_io_service_pool &pool, size_t number_of_queues = 1);
+		void set_ipv6(const std::array<uint8_t, 16> &binary_address, int prefixLen, uint32_t mtu) override; ///< nothing to set
+		void add_ipv4(const std::array<uint8_t, 4> &binary_address, int prefixLen) override; ///< nothing to set
+		int get_source_fd(size_t queue_nr) const override;
+};
+
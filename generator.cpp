@@ -0,0 +1,196 @@
+#include "generator.hpp"
+#include "Endian.h"
+#include "latency.hpp"
+#include "transform.hpp"
+#include "verify.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+/// the address to send to, IPv4 as mapped into IPv6 (::ffff:a.b.c.d), so that one IPv6 socket sends to both
+sockaddr_in6 make_destination(const std::string &destination, uint16_t port) {
+	sockaddr_in6 addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_port = htons(port);
+	in_addr ipv4;
+	if (inet_pton(AF_INET, destination.c_str(), &ipv4) == 1) {
+		addr.sin6_addr.s6_addr[10] = addr.sin6_addr.s6_addr[11] = 0xFF;
+		std::memcpy(&addr.sin6_addr.s6_addr[12], &ipv4, sizeof(ipv4));
+	} else if (inet_pton(AF_INET6, destination.c_str(), &addr.sin6_addr) != 1) {
+		throw std::invalid_argument("generator: bad address " + destination);
+	}
+	return addr;
+}
+
+} // namespace
+
+const unsigned char c_generator::marker[3] = { 100, 101, 102 };
+const size_t c_generator::payload_header_size;
+
+c_generator::c_generator(const std::string &destination, uint16_t port, size_t payload_size, size_t batch_size, size_t number_of_threads)
+	: m_destinations(1, make_destination(destination, port)), m_port(port), m_payload_size(payload_size), m_batch_size(batch_size),
+	m_number_of_threads(number_of_threads), m_transform(nullptr), m_sent_packets(0), m_running(0)
+{
+	if (m_payload_size < payload_header_size) throw std::invalid_argument("generator payload too small for marker, index and time");
+	if (m_batch_size < 1 || m_number_of_threads < 1) throw std::invalid_argument("generator needs batch and threads >= 1");
+}
+
+c_generator::~c_generator() {
+	join();
+}
+
+void c_generator::set_frame_output(const std::vector<int> &fds) {
+	m_frame_fds = fds;
+}
+
+void c_generator::set_transform(const c_transform *transform) {
+	m_transform = transform;
+}
+
+void c_generator::add_destination(const std::string &destination) {
+	m_destinations.push_back(make_destination(destination, m_port));
+}
+
+size_t c_generator::write_frame_headers(unsigned char *frame, const in6_addr &destination, uint16_t source_port) const {
+	const size_t udp_size = 8 + m_payload_size;
+	unsigned char *pi = frame; // struct tun_pi: flags, protocol
+	pi[0] = pi[1] = 0;
+	pi[2] = 0x86; pi[3] = 0xDD; // ETH_P_IPV6
+	unsigned char *ip = frame + 4;
+	std::memset(ip, 0, 40);
+	ip[0] = 0x60; // version 6
+	ip[4] = static_cast<unsigned char>(udp_size >> 8);
+	ip[5] = static_cast<unsigned char>(udp_size);
+	ip[6] = IPPROTO_UDP;
+	ip[7] = 64; // hop limit
+	in6_addr source = destination;
+	source.s6_addr[15] ^= 1;
+	std::memcpy(ip + 8, &source, 16);
+	std::memcpy(ip + 24, &destination, 16);
+	unsigned char *udp = ip + 40;
+	const uint16_t ports[3] = { htons(source_port), htons(m_port), htons(static_cast<uint16_t>(udp_size)) };
+	std::memcpy(udp, ports, sizeof(ports));
+	udp[6] = udp[7] = 0; // checksum is computed for each packet, when the payload is written
+	return 4 + 40 + 8;
+}
+
+void c_generator::start(uint64_t packet_count) {
+	// open the sockets here, so that a failure is reported to the caller and no thread ends without sending
+	for (size_t i = 0; m_frame_fds.empty() && (i < m_number_of_threads); i++) {
+		const int sock = socket(AF_INET6, SOCK_DGRAM, 0); // own socket (so own source port, and own flow) for each thread
+		if (sock < 0) {
+			const std::string error = strerror(errno);
+			close_sockets();
+			throw std::runtime_error("generator: socket: " + error);
+		}
+		m_sockets.push_back(sock);
+	}
+	m_running = m_number_of_threads;
+	for (size_t i = 0; i < m_number_of_threads; i++)
+		m_threads.emplace_back([this, i, packet_count] { send_loop(i, packet_count); });
+}
+
+void c_generator::join() {
+	for (auto & thread : m_threads) thread.join();
+	m_threads.clear();
+	close_sockets();
+}
+
+void c_generator::close_sockets() {
+	for (int sock : m_sockets) close(sock);
+	m_sockets.clear();
+}
+
+size_t c_generator::get_sent_packets() const {
+	return m_sent_packets.load();
+}
+
+void c_generator::send_loop(size_t thread_nr, uint64_t packet_count) {
+	std::vector<sockaddr_in6> addrs = m_destinations; // msg_name is not const
+	const bool frame_output = !m_frame_fds.empty();
+	int sock = frame_output ? m_frame_fds.at(thread_nr % m_frame_fds.size()) : m_sockets.at(thread_nr);
+
+	// all buffers of the batch are prepared once, later only the index is written
+	const size_t headers_size = frame_output ? 4 + 40 + 8 : 0;
+	const size_t message_size = headers_size + m_payload_size;
+	std::vector<unsigned char> messages(m_batch_size * message_size, 'x');
+	std::vector<iovec> iovecs(m_batch_size);
+	std::vector<mmsghdr> msgs(m_batch_size);
+	for (size_t i = 0; i < m_batch_size; i++) {
+		unsigned char *message = &messages.at(i * message_size);
+		if (frame_output) write_frame_headers(message, addrs.at(0).sin6_addr, static_cast<uint16_t>(10000 + thread_nr));
+		std::memcpy(message + headers_size, marker, sizeof(marker));
+		iovecs.at(i).iov_base = message;
+		iovecs.at(i).iov_len = message_size;
+		std::memset(&msgs.at(i), 0, sizeof(mmsghdr));
+		if (!frame_output) { // frame output sockets are connected
+			msgs.at(i).msg_hdr.msg_name = &addrs.at(0);
+			msgs.at(i).msg_hdr.msg_namelen = sizeof(sockaddr_in6);
+		}
+		msgs.at(i).msg_hdr.msg_iov = &iovecs.at(i);
+		msgs.at(i).msg_hdr.msg_iovlen = 1;
+	}
+	const std::vector<unsigned char> filler(m_payload_size - payload_header_size, 'x');
+	auto set_index = [&](size_t msg_nr, uint64_t index, uint64_t time_ns) {
+		unsigned char *payload = &messages.at(msg_nr * message_size) + headers_size;
+		const uint32_t index_le = Endian_hostToLittleEndian32(static_cast<uint32_t>(index)); // lower 32 bits
+		std::memcpy(payload + sizeof(marker), &index_le, sizeof(index_le));
+		const uint64_t time_le = Endian_hostToLittleEndian64(time_ns);
+		std::memcpy(payload + sizeof(marker) + sizeof(index_le), &time_le, sizeof(time_le));
+		if (m_transform) // always from clean filler, the previous index left it encoded with other nonce
+			m_transform->apply(filler.data(), payload + payload_header_size, filler.size(), static_cast<uint32_t>(index));
+		if (frame_output) { // as the kernel would do for UDP socket
+			unsigned char *ip = &messages.at(msg_nr * message_size) + 4;
+			const size_t udp_size = 8 + m_payload_size;
+			ip[40 + 6] = ip[40 + 7] = 0;
+			const uint16_t checksum = get_udp_checksum(ip, 6, 40, udp_size);
+			std::memcpy(ip + 40 + 6, &checksum, sizeof(checksum));
+		}
+	};
+	// where batch nr batch_nr goes; with one destination and one fd per thread nothing changes between batches
+	auto set_target = [&](uint64_t batch_nr) {
+		if (frame_output) sock = m_frame_fds.at(batch_nr % m_frame_fds.size());
+		else if (addrs.size() > 1)
+			for (auto & msg : msgs) msg.msg_hdr.msg_name = &addrs.at(batch_nr % addrs.size());
+	};
+	auto send_all = [&](size_t count) {
+		size_t done = 0;
+		while (done < count) {
+			int sent = sendmmsg(sock, &msgs.at(done), static_cast<unsigned int>(count - done), 0);
+			if (sent < 0) {
+				if (errno == EINTR || errno == ENOBUFS || errno == EAGAIN) continue;
+				std::cerr << "generator: sendmmsg: " << strerror(errno) << std::endl;
+				return false;
+			}
+			done += sent;
+		}
+		m_sent_packets.fetch_add(count, std::memory_order_relaxed);
+		return true;
+	};
+
+	const uint64_t batch_step = static_cast<uint64_t>(m_batch_size) * m_number_of_threads;
+	for (uint64_t first = thread_nr * m_batch_size; first < packet_count; first += batch_step) {
+		size_t count = 0;
+		const uint64_t now = get_monotonic_ns(); // whole batch goes out in one call, so one time is close enough
+		for (uint64_t index = first; (index < packet_count) && (count < m_batch_size); ++index, ++count)
+			set_index(count, index, now);
+		set_target(first / m_batch_size);
+		if (!send_all(count)) break;
+	}
+
+	if (m_running.fetch_sub(1) == 1) { // the last thread to finish sends the end marker, few times as it could be dropped
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		set_index(0, packet_count, get_monotonic_ns());
+		for (int i = 0; i < 3; i++) send_all(1);
+	}
+}
+
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <netinet/in.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+class c_transform;
+
+/// Traffic generator: sends UDP datagrams in the format that the receiver checks
+/// (marker 100,101,102, 4 byte little-endian packet index, 8 byte little-endian send time from get_monotonic_ns()), using sendmmsg() batches from many threads.
+/// Thread t sends batches t, t+N, t+2N... so the indexes arrive almost in order.
+class c_generator final {
+	public:
+		/// destination - IPv6 or IPv4 address to send to (routed into the TUN), throws if it is not one;
+		/// batch_size - datagrams per sendmmsg()
+		c_generator(const std::string &destination, uint16_t port, size_t payload_size, size_t batch_size, size_t number_of_threads);
+		~c_generator();
+		c_generator(const c_generator &) = delete;
+		c_generator &operator=(const c_generator &) = delete;
+
+		/// instead of UDP to destination, write whole frames as read from TUN (struct tun_pi, IPv6, UDP, payload)
+		/// into these fds (sockets, e.g. the source fds of c_loopback_device_asio); batch nr b uses fds[b % fds.size()]
+		void set_frame_output(const std::vector<int> &fds);
+		/// encode the payload after payload_header_size with this transform (nonce is the 32 bit index on wire); not owned
+		void set_transform(const c_transform *transform);
+		/// also send to this address: batch nr b goes to destination b % count (and with frame output, to fd b % fds.size());
+		/// e.g. one destination routed into each of many TUNs; throws if it is not an address
+		void add_destination(const std::string &destination);
+
+		/// starts sending indexes 0..packet_count-1, and then index packet_count (few times) to tell the receiver to end.
+		/// Only lower 32 bits of index are sent, receiver unwraps them. Throws if a socket can not be opened
+		void start(uint64_t packet_count);
+		void join(); ///< wait until all is sent, and close the sockets
+		size_t get_sent_packets() const;
+
+		static const unsigned char marker[3]; ///< the marker at start of UDP payload
+		static const size_t payload_header_size = 3 + 4 + 8; ///< marker, index, time; the rest of payload is filler 'x'
+
+	private:
+		std::vector<sockaddr_in6> m_destinations; ///< the one from constructor, then these from add_destination
+		const uint16_t m_port;
+		const size_t m_payload_size;
+		const size_t m_batch_size;
+		const size_t m_number_of_threads;
+		std::vector<int> m_frame_fds; ///< if not empty, we write frames to them (see set_frame_output)
+		const c_transform *m_transform; ///< if not null, encodes the filler (see set_transform)
+		std::vector<int> m_sockets; ///< own UDP socket of each thread (unless frame output), opened by start()
+		std::vector<std::thread> m_threads;
+		std::atomic<size_t> m_sent_packets;
+		std::atomic<size_t> m_running; ///< threads that did not finish sending yet
+
+		void send_loop(size_t thread_nr, uint64_t packet_count); ///< main function of one thread
+		void close_sockets();
+		/// writes the tun_pi, IPv6 and UDP headers (for payload of m_payload_size) to frame, returns their size
+		size_t write_frame_headers(unsigned char *frame, const in6_addr &destination, uint16_t source_port) const;
+};
+
@@ -0,0 +1,167 @@
+#include "ip_packet.hpp"
+#include <cstring>
+#include <netinet/in.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IP_PACKET_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+const int max_extension_headers = 8; ///< bound the work on crafted packets
+
+inline size_t read_be16(const unsigned char *data) {
+	return (static_cast<size_t>(data[0]) << 8) | data[1];
+}
+}
+
+c_ip_packet::c_ip_packet(const unsigned char *ip, size_t size)
+	: m_ip(ip), m_ip_size(0), m_version(0), m_l4_proto(0), m_l4_pos(0), m_udp_payload_size(0), m_valid(false), m_udp(false)
+{
+	if (size < 1) return;
+	const unsigned version = ip[0] >> 4;
+	if (version == 4) m_valid = parse_ipv4(size);
+	else if (version == 6) m_valid = parse_ipv6(size);
+	if (!m_valid) return;
+	m_version = version;
+	if ((m_l4_proto == IPPROTO_UDP) && (m_l4_pos != 0)) parse_udp();
+}
+
+bool c_ip_packet::parse_ipv4(size_t size) {
+	if (size < 20) return false;
+	const size_t header_size = (m_ip[0] & 0x0F) * 4;
+	const size_t total_size = read_be16(m_ip + 2);
+	if ((header_size < 20) || (total_size < header_size) || (total_size > size)) return false;
+	m_ip_size = total_size;
+	m_l4_proto = m_ip[9];
+	const size_t fragment_offset = read_be16(m_ip + 6) & 0x1FFF;
+	m_l4_pos = (fragment_offset == 0) ? header_size : 0; // other fragments do not start with L4 header
+	return true;
+}
+
+bool c_ip_packet::parse_ipv6(size_t size) {
+	if (size < 40) return false;
+	const size_t payload_size = read_be16(m_ip + 4);
+	m_ip_size = (payload_size == 0) ? size : 40 + payload_size; // 0: jumbogram (or BIG TCP), size is from the read
+	if (m_ip_size > size) return false;
+
+	uint8_t next = m_ip[6];
+	size_t pos = 40;
+	for (int i = 0; i < max_extension_headers; ++i) {
+		size_t header_size;
+		switch (next) {
+			case IPPROTO_HOPOPTS:
+			case IPPROTO_ROUTING:
+			case IPPROTO_DSTOPTS:
+				if (pos + 8 > m_ip_size) return false;
+				header_size = (static_cast<size_t>(m_ip[pos + 1]) + 1) * 8;
+				break;
+			case IPPROTO_FRAGMENT:
+				if (pos + 8 > m_ip_size) return false;
+				if (read_be16(m_ip + pos + 2) & 0xFFF8) { // not the first fragment, no L4 header here
+					m_l4_proto = m_ip[pos];
+					return true;
+				}
+				header_size = 8;
+				break;
+			case IPPROTO_AH:
+				if (pos + 8 > m_ip_size) return false;
+				header_size = (static_cast<size_t>(m_ip[pos + 1]) + 2) * 4;
+				break;
+			case IPPROTO_NONE:
+			case IPPROTO_ESP: // what follows is not readable
+				m_l4_proto = next;
+				return true;
+			default: // upper layer protocol
+				m_l4_proto = next;
+				m_l4_pos = pos;
+				return true;
+		}
+		if (pos + header_size > m_ip_size) return false;
+		next = m_ip[pos];
+		pos += header_size;
+	}
+	return false; // too many extension headers
+}
+
+void c_ip_packet::parse_udp() {
+	if (m_l4_pos + 8 > m_ip_size) return;
+	const size_t udp_size = read_be16(m_ip + m_l4_pos + 4);
+	if ((udp_size < 8) || (m_l4_pos + udp_size > m_ip_size)) return;
+	m_udp_payload_size = udp_size - 8;
+	m_udp = true;
+}
+
+bool c_ip_packet::is_valid() const {
+	return m_valid;
+}
+
+unsigned c_ip_packet::get_version() const {
+	return m_version;
+}
+
+uint8_t c_ip_packet::get_l4_proto() const {
+	return m_l4_proto;
+}
+
+size_t c_ip_packet::get_l4_pos() const {
+	return m_l4_pos;
+}
+
+size_t c_ip_packet::get_ip_size() const {
+	return m_ip_size;
+}
+
+bool c_ip_packet::is_udp() const {
+	return m_udp;
+}
+
+const unsigned char *c_ip_packet::get_udp_payload() const {
+	return m_ip + m_l4_pos + 8;
+}
+
+size_t c_ip_packet::get_udp_payload_size() const {
+	return m_udp_payload_size;
+}
+
+namespace {
+const unsigned char *find_marker_scalar(const unsigned char *data, size_t size, const unsigned char marker[3]) {
+	const unsigned char *end = data + size;
+	while (size >= 3) {
+		const unsigned char *first = static_cast<const unsigned char *>(std::memchr(data, marker[0], size - 2));
+		if (!first) return nullptr;
+		if ((first[1] == marker[1]) && (first[2] == marker[2])) return first;
+		data = first + 1;
+		size = end - data;
+	}
+	return nullptr;
+}
+
+#ifdef IP_PACKET_X86
+/// compares 32 starting positions at once: byte i matches marker[0], byte i+1 marker[1], byte i+2 marker[2]
+__attribute__((target("avx2")))
+const unsigned char *find_marker_avx2(const unsigned char *data, size_t size, const unsigned char marker[3]) {
+	const __m256i first = _mm256_set1_epi8(static_cast<char>(marker[0]));
+	const __m256i second = _mm256_set1_epi8(static_cast<char>(marker[1]));
+	const __m256i third = _mm256_set1_epi8(static_cast<char>(marker[2]));
+	size_t pos = 0;
+	for (; pos + 32 + 2 <= size; pos += 32) {
+		const __m256i match0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos)), first);
+		const __m256i match1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + 1)), second);
+		const __m256i match2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + 2)), third);
+		const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(match0, match1), match2)));
+		if (mask) return data + pos + __builtin_ctz(mask);
+	}
+	return find_marker_scalar(data + pos, size - pos, marker);
+}
+
+const bool cpu_has_avx2 = [] { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }(); // can run before main
+#endif
+}
+
+const unsigned char *find_marker(const unsigned char *data, size_t size, const unsigned char marker[3]) {
+#ifdef IP_PACKET_X86
+	if (cpu_has_avx2) return find_marker_avx2(data, size, marker);
+#endif
+	return find_marker_scalar(data, size, marker);
+}
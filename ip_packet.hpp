@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Headers of one IP packet, found without copying: IPv4 (with options), or IPv6 with its extension headers followed.
+/// Lengths are checked against the read size and against the length fields of IP and UDP.
+class c_ip_packet final {
+	public:
+		/// ip - the IP packet (after struct tun_pi, or after virtio_net_hdr)
+		c_ip_packet(const unsigned char *ip, size_t size);
+
+		bool is_valid() const; ///< are IP headers complete and lengths consistent
+		unsigned get_version() const; ///< 4 or 6; 0 if not valid
+		uint8_t get_l4_proto() const; ///< IPPROTO_UDP, IPPROTO_TCP, ... (after extension headers)
+		/// where L4 header starts; 0 if there is none (a fragment other then first, ESP, no next header)
+		size_t get_l4_pos() const;
+		size_t get_ip_size() const; ///< size by the IP length field (can be less then what was read)
+		bool is_udp() const; ///< valid, has complete UDP header with sane length
+		const unsigned char *get_udp_payload() const; ///< if is_udp()
+		size_t get_udp_payload_size() const; ///< if is_udp(), by the UDP length field
+
+	private:
+		const unsigned char *m_ip;
+		size_t m_ip_size;
+		unsigned m_version;
+		uint8_t m_l4_proto;
+		size_t m_l4_pos;
+		size_t m_udp_payload_size;
+		bool m_valid;
+		bool m_udp;
+
+		bool parse_ipv4(size_t size);
+		bool parse_ipv6(size_t size);
+		void parse_udp();
+};
+
+/// Position of first occurrence of 3 bytes (e.g. the test marker) in data, nullptr if none.
+/// For packets of unknown layout; uses AVX2 (32 positions per step) when CPU has it.
+const unsigned char *find_marker(const unsigned char *data, size_t size, const unsigned char marker[3]);
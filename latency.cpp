@@ -0,0 +1,148 @@
+#include "latency.hpp"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+#include <utility>
+
+uint64_t get_monotonic_ns() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+}
+
+constexpr unsigned int c_histogram::sub_bucket_bits;
+constexpr size_t c_histogram::sub_buckets;
+constexpr unsigned int c_histogram::max_value_bits;
+constexpr size_t c_histogram::number_of_buckets;
+
+c_histogram::c_histogram()
+	: m_counts(number_of_buckets, 0), m_count(0)
+{ }
+
+size_t c_histogram::bucket_of(uint64_t value) {
+	if (value >> max_value_bits) return number_of_buckets - 1;
+	if (value < 2 * sub_buckets) return static_cast<size_t>(value);
+	const unsigned int msb = 63 - __builtin_clzll(value);
+	const unsigned int shift = msb - sub_bucket_bits; // value >> shift is in sub_buckets..2*sub_buckets-1
+	return shift * sub_buckets + static_cast<size_t>(value >> shift);
+}
+
+uint64_t c_histogram::bucket_lowest(size_t bucket) {
+	if (bucket < 2 * sub_buckets) return bucket;
+	const unsigned int shift = static_cast<unsigned int>(bucket / sub_buckets) - 1;
+	return static_cast<uint64_t>(bucket % sub_buckets + sub_buckets) << shift;
+}
+
+uint64_t c_histogram::bucket_highest(size_t bucket) {
+	if (bucket < 2 * sub_buckets) return bucket;
+	const unsigned int shift = static_cast<unsigned int>(bucket / sub_buckets) - 1;
+	return bucket_lowest(bucket) + (uint64_t(1) << shift) - 1;
+}
+
+void c_histogram::add_to_bucket(size_t bucket, uint64_t count) {
+	m_counts.at(bucket) += count;
+	m_count += count;
+}
+
+void c_histogram::subtract(const c_histogram &other) {
+	for (size_t i = 0; i < number_of_buckets; ++i) m_counts[i] -= other.m_counts[i];
+	m_count -= other.m_count;
+}
+
+uint64_t c_histogram::get_count() const {
+	return m_count;
+}
+
+uint64_t c_histogram::get_bucket_count(size_t bucket) const {
+	return m_counts.at(bucket);
+}
+
+uint64_t c_histogram::get_percentile(double percent) const {
+	if (m_count == 0) return 0;
+	uint64_t wanted = static_cast<uint64_t>(std::ceil(percent / 100. * m_count));
+	if (wanted < 1) wanted = 1;
+	uint64_t sum = 0;
+	for (size_t i = 0; i < number_of_buckets; ++i) {
+		sum += m_counts[i];
+		if (sum >= wanted) return bucket_highest(i);
+	}
+	return get_max();
+}
+
+uint64_t c_histogram::get_max() const {
+	for (size_t i = number_of_buckets; i > 0; --i)
+		if (m_counts[i - 1]) return bucket_highest(i - 1);
+	return 0;
+}
+
+void c_histogram::print(std::ostream &out, const std::string &name) const {
+	const double us = 1000;
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << "Latency " << name << ": " << m_count << " pck";
+	if (m_count) {
+		out << std::fixed << std::setprecision(1);
+		const std::pair<const char *, double> percentiles[] = { {"50", 50}, {"90", 90}, {"99", 99}, {"99.9", 99.9}, {"99.99", 99.99} };
+		for (const auto & percentile : percentiles)
+			out << " p" << percentile.first << "=" << get_percentile(percentile.second) / us;
+		out << " max=" << get_max() / us << " us";
+	}
+	out << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
+
+c_latency_recorder::c_thread_data::c_thread_data()
+	: m_buckets(nullptr), m_min(UINT64_MAX), m_max(0)
+{ }
+
+c_latency_recorder::c_thread_data::~c_thread_data() {
+	delete[] m_buckets.load();
+}
+
+void c_latency_recorder::record(uint64_t latency_ns) {
+	c_thread_data & data = m_threads.local();
+	std::atomic<uint64_t> * buckets = data.m_buckets.load(std::memory_order_relaxed);
+	if (!buckets) { // first value from this thread
+		buckets = new std::atomic<uint64_t>[c_histogram::number_of_buckets];
+		for (size_t i = 0; i < c_histogram::number_of_buckets; ++i) buckets[i].store(0, std::memory_order_relaxed);
+		data.m_buckets.store(buckets, std::memory_order_release); // the reporter sees them zeroed
+	}
+	// we are the only writer of this thread's data, so no read-modify-write is needed
+	std::atomic<uint64_t> & bucket = buckets[c_histogram::bucket_of(latency_ns)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (latency_ns < data.m_min.load(std::memory_order_relaxed)) data.m_min.store(latency_ns, std::memory_order_relaxed);
+	if (latency_ns > data.m_max.load(std::memory_order_relaxed)) data.m_max.store(latency_ns, std::memory_order_relaxed);
+}
+
+c_histogram c_latency_recorder::get_merged() const {
+	c_histogram merged;
+	m_threads.for_each([&merged](const c_thread_data & data) {
+		const std::atomic<uint64_t> * buckets = data.m_buckets.load(std::memory_order_acquire);
+		if (!buckets) return;
+		for (size_t i = 0; i < c_histogram::number_of_buckets; ++i) {
+			const uint64_t count = buckets[i].load(std::memory_order_relaxed);
+			if (count) merged.add_to_bucket(i, count);
+		}
+	});
+	return merged;
+}
+
+void c_latency_recorder::print_window(std::ostream &out) {
+	c_histogram merged = get_merged();
+	c_histogram window = merged;
+	window.subtract(m_last_window);
+	window.print(out, "window");
+	m_last_window = std::move(merged);
+}
+
+void c_latency_recorder::print(std::ostream &out) const {
+	get_merged().print(out, "all");
+	uint64_t min = UINT64_MAX, max = 0;
+	m_threads.for_each([&](const c_thread_data & data) {
+		min = std::min(min, data.m_min.load(std::memory_order_relaxed));
+		max = std::max(max, data.m_max.load(std::memory_order_relaxed));
+	});
+	if (max) out << "Latency exact: min=" << min / 1000. << " max=" << max / 1000. << " us" << std::endl;
+}
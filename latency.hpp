@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread_slots.hpp"
+
+/// Current CLOCK_MONOTONIC time in ns; the generator puts it into packets and the receiver subtracts it
+/// (both run on same host, so the clocks are the same)
+uint64_t get_monotonic_ns();
+
+/// Log-linear histogram (like HdrHistogram): values below 2*sub_buckets are counted exactly, and then each power of two
+/// is split into sub_buckets linear buckets, so a value is known with relative error below 1/sub_buckets.
+/// Not thread-safe, it is the merged copy that is printed; see c_latency_recorder.
+class c_histogram final {
+	public:
+		static constexpr unsigned int sub_bucket_bits = 6; ///< 64 sub buckets, error < 1.6%
+		static constexpr size_t sub_buckets = size_t(1) << sub_bucket_bits;
+		static constexpr unsigned int max_value_bits = 40; ///< values above 2^40 (~18 minutes in ns) go to the last bucket
+		static constexpr size_t number_of_buckets = (max_value_bits - sub_bucket_bits + 1) * sub_buckets;
+
+		c_histogram();
+
+		static size_t bucket_of(uint64_t value); ///< in which bucket is this value counted
+		static uint64_t bucket_lowest(size_t bucket); ///< smallest value that is counted in this bucket
+		static uint64_t bucket_highest(size_t bucket); ///< biggest value that is counted in this bucket
+
+		void add_to_bucket(size_t bucket, uint64_t count);
+		void subtract(const c_histogram &other); ///< other must be an older copy of same data (used to get a window)
+
+		uint64_t get_count() const;
+		uint64_t get_bucket_count(size_t bucket) const;
+		/// value below which is given percent (0..100) of values, as highest value of the bucket; 0 if empty
+		uint64_t get_percentile(double percent) const;
+		uint64_t get_max() const; ///< highest value of the highest used bucket; 0 if empty
+
+		/// prints count, percentiles p50..p99.99 and max, values in us
+		void print(std::ostream &out, const std::string &name) const;
+
+	private:
+		std::vector<uint64_t> m_counts;
+		uint64_t m_count; ///< sum of m_counts
+};
+
+/// Collects latencies from many threads: each thread adds into own histogram (no locks, no shared cache lines),
+/// and the reporter merges them.
+class c_latency_recorder final {
+	public:
+		void record(uint64_t latency_ns); ///< add one value, from any thread
+		c_histogram get_merged() const; ///< all values of all threads so far (the threads can be still adding)
+
+		/// prints the values added since previous print_window(); call it only from one thread (the reporter)
+		void print_window(std::ostream &out);
+		void print(std::ostream &out) const; ///< prints all values, and the exact max and min
+
+	private:
+		struct c_thread_data {
+			std::atomic<std::atomic<uint64_t> *> m_buckets; ///< allocated by the owner thread on first use
+			std::atomic<uint64_t> m_min;
+			std::atomic<uint64_t> m_max;
+			c_thread_data();
+			~c_thread_data();
+		};
+		c_thread_slots<c_thread_data> m_threads;
+		c_histogram m_last_window; ///< the merged histogram at previous print_window()
+};
@@ -6,167 +6,41 @@
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
-#include <fcntl.h>
-#include <linux/if_tun.h>
-#include <net/if.h>
-#include <sys/ioctl.h>
+#include <arpa/inet.h>
 #include <unistd.h>
-#include "NetPlatform.h"
+#include "buffer_pool.hpp"
+#include "busy_poll_rx.hpp"
+#include "device.hpp"
+#include "generator.hpp"
+#include "ip_packet.hpp"
+#include "transform.hpp"
+#include "udp_forwarder.hpp"
+#include "uring_rx.hpp"
+#include "verify.hpp"
+#include "vnet_hdr.hpp"
 #include "counter.hpp"
+#include "packet_check.hpp"
+#include "latency.hpp"
+#include "packet_stats.hpp"
+#include "pcap_capture.hpp"
+#include "read_loop.hpp"
+#include "stats_export.hpp"
+#include "thread_placement.hpp"
 
 using namespace std;
 
-template <typename T> void memzero(const T & obj) {
-	std::memset( (void*) & obj , 0 , sizeof(T) );
-}
-
-template <typename T>
-class as_zerofill : public T {
-	public:
-		as_zerofill() {
-			assert( sizeof(*this) == sizeof(T) ); // TODO move to static assert. sanity check. quote isostd
-			void* baseptr = static_cast<void*>( dynamic_cast<T*>(this) );
-			assert(baseptr == this); // TODO quote isostd
-			memset( baseptr , 0 , sizeof(T) );
-		}
-		T& get() { return *this; }
-};
-
-/******************************************************************/
-
-class c_tun_device_linux_asio final {
-	public:
-		c_tun_device_linux_asio(size_t number_of_threads);
-		~c_tun_device_linux_asio();
-		void set_ipv6(const std::array<uint8_t, 16> &binary_address, int prefixLen, uint32_t mtu);
-		boost::asio::posix::stream_descriptor &get_stream_descriptor();
-		std::atomic<size_t> send_data_size;
-	private:
-		const int m_tun_fd;
-		boost::asio::io_service m_io_service;
-		boost::asio::io_service::work m_idle_work;
-		boost::asio::posix::stream_descriptor m_tun_handler;
-		std::vector<std::thread> m_io_service_threads;
-};
-
-c_tun_device_linux_asio::c_tun_device_linux_asio(size_t number_of_threads)
-	:
-		send_data_size(0),
-		m_tun_fd(open("/dev/net/tun", O_RDWR)),
-		m_io_service(),
-		m_idle_work(m_io_service),
-		m_tun_handler(m_io_service, m_tun_fd)
-{
-	if (!m_tun_handler.is_open()) throw std::runtime_error("TUN is not open");
-	for (size_t i = 0; i < number_of_threads; i++)
-		m_io_service_threads.emplace_back([this] {
-			std::cout << "start asio thread\n";
-			m_io_service.run();
-		});
-}
-
-c_tun_device_linux_asio::~c_tun_device_linux_asio() {
-	m_io_service.stop();
-	for (auto & thread : m_io_service_threads)
-		thread.join();
-}
-
-void c_tun_device_linux_asio::set_ipv6(const std::array<uint8_t, 16> &binary_address, int prefixLen, uint32_t mtu) {
-	as_zerofill< ifreq > ifr; // the if request
-	ifr.ifr_flags = IFF_TUN; // || IFF_MULTI_QUEUE; TODO
-	strncpy(ifr.ifr_name, "galaxy%d", IFNAMSIZ);
-	std::cout << "iface name " << ifr.ifr_name << '\n';
-	std::cout << "IFNAMSIZ " << IFNAMSIZ << '\n';
-	auto errcode_ioctl =  ioctl(m_tun_fd, TUNSETIFF, static_cast<void *>(&ifr));
-	if (errcode_ioctl < 0) throw std::runtime_error("ioctl error");
-	//	assert(binary_address[0] == 0xFD);
-	//	assert(binary_address[1] == 0x42);
-	NetPlatform_addAddress(ifr.ifr_name, binary_address.data(), prefixLen, Sockaddr_AF_INET6);
-	NetPlatform_setMTU(ifr.ifr_name, mtu);
-	m_tun_handler.release();
-	m_tun_handler.assign(m_tun_fd);
-}
-
-boost::asio::posix::stream_descriptor &c_tun_device_linux_asio::get_stream_descriptor() {
-	return m_tun_handler;
-}
-
 /******************************************************************/
 
-/// Were all packets received in order?
-struct c_packet_check {
-	c_packet_check(size_t max_packet_index);
-
-	void see_packet(size_t packet_index);
-
-	vector<bool> m_seen; ///< was this packet seen yet
-	size_t m_count_dupli;
-	size_t m_count_uniq;
-	size_t m_count_reord;
-	size_t m_max_index;
-	bool m_i_thought_lost; ///< we thought packets are lost
-
-	void print() const;
-	bool packets_maybe_lost() const; ///< do we think now that some packets were lost?
-};
-
-	c_packet_check::c_packet_check(size_t max_packet_index)
-: m_seen( max_packet_index , false ), m_max_index(0)
-{ }
-
-bool c_packet_check::packets_maybe_lost() const {
-	size_t max_reodrder = 1000; // if more packets are out then it's probably lost.
-	// do we have packet-index much higher then number of packets recevied at all:
-	if (m_max_index > m_count_uniq + max_reodrder) return true;
-	return false;
-}
-
-void c_packet_check::see_packet(size_t packet_index) {
-	if (packet_index < m_max_index) {
-		++ m_count_reord;
-	}
-	m_max_index = std::max( m_max_index , packet_index );
-
-	if (packets_maybe_lost()) m_i_thought_lost=true;
-
-	if (m_seen.at(packet_index)) {
-		++ m_count_dupli;
-		const size_t warn_max = 100;
-		if (m_count_dupli < warn_max)	{
-			std::cout << "duplicate at packet_index=" << packet_index << '\n';
-			print();
-		}
-		if (m_count_dupli == warn_max)	std::cout << "duplicate at packet_index - will hide further warnings\n";
-	} else { // a not-before-seen packet index
-		++ m_count_uniq;
-	}
-	m_seen.at(packet_index) = true;
-}
-
-void c_packet_check::print() const {
-	auto missing = m_max_index - m_count_uniq; // mising now. maybe will come in a moment as reordered, or maybe are really lost
-	double missing_part = 0;
-	if (m_max_index>0) missing_part = (double)missing / m_max_index;
-	auto & out = std::cout;
-	out << "Packets: uniq="<<m_count_uniq/1000<<"K ; Max="<<m_max_index
-		<<" Dupli="<<m_count_dupli
-		<<" Reord="<<m_count_reord
-		<<" Missing(now)=" << missing << " "
-		<< std::setw(3) << std::setprecision(2) << std::fixed << missing_part*100. << "%";
-
-	if (packets_maybe_lost()) out<<" LOST-PACKETS ";
-	else if (m_i_thought_lost) out<<" (packet seemed lost in past, but now all looks fine)";
-
-	out<<endl;
-}
-
 #define global_config_end_after_packet (4*1000*1000)
-const int config_buf_size = 65535 * 1;
 
 int main(int argc, char **argv) {
+	check_cpu_for_build();
 
 	int number_of_threads;
 
@@ -180,69 +54,325 @@ int main(int argc, char **argv) {
 		number_of_threads = 1;
 	std::cout << "number of threads " << number_of_threads << '\n';
 
-	c_tun_device_linux_asio tun_device(number_of_threads);
+	int number_of_queues = 1; // --queues N : open N queues of the TUN (IFF_MULTI_QUEUE)
+	it = std::find(args.begin(), args.end(), "--queues");
+	if (it != args.end()) number_of_queues = atoi((++it)->c_str());
+	// --io-per-queue : each queue gets own io_service and own thread
+	const bool io_service_per_queue = std::find(args.begin(), args.end(), "--io-per-queue") != args.end();
+	std::cout << "number of queues " << number_of_queues << (io_service_per_queue ? " (io_service per queue)" : "") << '\n';
+
+	// --cpus LIST : pin I/O thread nr N (asio thread, or the uring/forward thread of queue N) to the N-th CPU of LIST, e.g. 2-5,8;
+	// with --io-per-queue or --engine uring|poll the read buffers of queue N are then allocated on the NUMA node of that CPU
+	// --fifo PRIO : run the I/O threads with SCHED_FIFO priority PRIO (1..99, needs CAP_SYS_NICE)
+	// --stats-cpu N : pin the reporter (main) thread to CPU N, away from the I/O threads
+	std::vector<int> io_cpus;
+	it = std::find(args.begin(), args.end(), "--cpus");
+	if (it != args.end()) io_cpus = parse_cpu_list(*(++it));
+	int fifo_priority = 0;
+	it = std::find(args.begin(), args.end(), "--fifo");
+	if (it != args.end()) fifo_priority = atoi((++it)->c_str());
+	const c_thread_placement placement(io_cpus, fifo_priority);
+	int stats_cpu = -1;
+	it = std::find(args.begin(), args.end(), "--stats-cpu");
+	if (it != args.end()) stats_cpu = atoi((++it)->c_str());
+	if ((stats_cpu >= 0) && (std::find(io_cpus.begin(), io_cpus.end(), stats_cpu) != io_cpus.end()))
+		std::cout << "warning: --stats-cpu " << stats_cpu << " is also in --cpus, the reporter is not isolated\n";
+
+	// --engine asio|uring|poll : how to read the TUN. uring - one thread per queue, each with own io_uring;
+	// poll - one thread per queue that busy-polls non-blocking reads (lowest latency, burns the CPU; use with --cpus)
+	string engine = "asio";
+	it = std::find(args.begin(), args.end(), "--engine");
+	if (it != args.end()) engine = *(++it);
+	if ((engine != "asio") && (engine != "uring") && (engine != "poll")) throw std::invalid_argument("unknown --engine " + engine);
+	int uring_depth = 64; // --uring-depth N : reads kept in flight on each queue
+	it = std::find(args.begin(), args.end(), "--uring-depth");
+	if (it != args.end()) uring_depth = atoi((++it)->c_str());
+	// --read-depth N : asio reads kept in flight on each queue, each with own buffer; with more threads (-j) their
+	// completions are then processed at the same time, not one after another
+	int read_depth = 1;
+	it = std::find(args.begin(), args.end(), "--read-depth");
+	if (it != args.end()) read_depth = atoi((++it)->c_str());
+	if (read_depth < 1) throw std::invalid_argument("--read-depth must be at least 1");
+	int poll_spin = 10000; // --poll-spin N : empty reads the poll engine spins before it sleeps in poll()
+	it = std::find(args.begin(), args.end(), "--poll-spin");
+	if (it != args.end()) poll_spin = atoi((++it)->c_str());
+	std::cout << "engine " << engine << '\n';
+
+	// --offload : IFF_VNET_HDR with TSO/USO, reads can be GSO super-packets carrying many test packets
+	const bool offload = std::find(args.begin(), args.end(), "--offload") != args.end();
+	int mtu = 65500; // --mtu N ; big default to get big frames without --offload
+	it = std::find(args.begin(), args.end(), "--mtu");
+	if (it != args.end()) mtu = atoi((++it)->c_str());
+	std::cout << "mtu " << mtu << (offload ? " (offload)" : "") << '\n';
+	int buf_size = 65535; // --buf-size N : size of each read buffer; reads of bigger packets are cut
+	it = std::find(args.begin(), args.end(), "--buf-size");
+	if (it != args.end()) buf_size = atoi((++it)->c_str());
+	if (buf_size < 64) throw std::invalid_argument("--buf-size too small");
+	if (buf_size < mtu + 4 + (offload ? 12 : 0)) // struct tun_pi, virtio_net_hdr
+		std::cout << "warning: --buf-size " << buf_size << " is less then a packet of the mtu " << mtu << " with headers\n";
+	// --address ADDR : IPv6 address of the TUN, --prefix N : its prefix length; the generator sends into the prefix
+	string tun_address = "fd00:8080:8080:8080:8080:8080:8080:8080";
+	it = std::find(args.begin(), args.end(), "--address");
+	if (it != args.end()) tun_address = *(++it);
+	int tun_prefix = 8;
+	it = std::find(args.begin(), args.end(), "--prefix");
+	if (it != args.end()) tun_prefix = atoi((++it)->c_str());
 	std::array<uint8_t, 16> ip_address;
-	ip_address.fill(0x80);
-	ip_address.at(0) = 0xFD;
-	ip_address.at(1) = 0x00;
-	tun_device.set_ipv6(ip_address, 8, 65500);
+	if ((inet_pton(AF_INET6, tun_address.c_str(), ip_address.data()) != 1) || (tun_prefix < 1) || (tun_prefix > 128))
+		throw std::invalid_argument("bad --address or --prefix: " + tun_address + "/" + std::to_string(tun_prefix));
+	// --address4 A.B.C.D : also an IPv4 address of the TUN, --prefix4 N : its prefix length (24); e.g. with --gen-dst 10.80.0.2
+	string tun_address4;
+	it = std::find(args.begin(), args.end(), "--address4");
+	if (it != args.end()) tun_address4 = *(++it);
+	int tun_prefix4 = 24;
+	it = std::find(args.begin(), args.end(), "--prefix4");
+	if (it != args.end()) tun_prefix4 = atoi((++it)->c_str());
+	std::array<uint8_t, 4> ip_address4;
+	if (!tun_address4.empty()
+		&& ((inet_pton(AF_INET, tun_address4.c_str(), ip_address4.data()) != 1) || (tun_prefix4 < 1) || (tun_prefix4 > 32)))
+		throw std::invalid_argument("bad --address4 or --prefix4: " + tun_address4 + "/" + std::to_string(tun_prefix4));
+
+	uint64_t end_after_packet = global_config_end_after_packet; // --packets N : end the test on packet index N
+	it = std::find(args.begin(), args.end(), "--packets");
+	if (it != args.end()) end_after_packet = strtoull((++it)->c_str(), nullptr, 10);
+
+	// --generate N : also send the test traffic, from N threads, into the TUN
+	int generator_threads = 0;
+	it = std::find(args.begin(), args.end(), "--generate");
+	if (it != args.end()) generator_threads = atoi((++it)->c_str());
+	int generator_batch = 32; // --gen-batch N : datagrams in one sendmmsg()
+	it = std::find(args.begin(), args.end(), "--gen-batch");
+	if (it != args.end()) generator_batch = atoi((++it)->c_str());
+	int generator_size = 100; // --gen-size N : UDP payload size
+	it = std::find(args.begin(), args.end(), "--gen-size");
+	if (it != args.end()) generator_size = atoi((++it)->c_str());
+	string generator_destination = "fd00:8080::1"; // --gen-dst ADDR : any address routed into the TUN (fd00::/8), or IPv4
+	it = std::find(args.begin(), args.end(), "--gen-dst");
+	if (it != args.end()) generator_destination = *(++it);
+
+	// --forward ADDR : forward mode, frames read from the TUN are checked and sent in sendmmsg() batches to UDP peer ADDR,
+	// e.g. to other instance that runs with --udp-listen; the TUN is then read by the forwarder instead of --engine
+	string forward_address;
+	it = std::find(args.begin(), args.end(), "--forward");
+	if (it != args.end()) forward_address = *(++it);
+	int forward_port = 4430; // --forward-port N : UDP port of the peer
+	it = std::find(args.begin(), args.end(), "--forward-port");
+	if (it != args.end()) forward_port = atoi((++it)->c_str());
+	int udp_listen_port = 0; // --udp-listen N : receive frames on this UDP port (recvmmsg), check them and write into the TUN
+	it = std::find(args.begin(), args.end(), "--udp-listen");
+	if (it != args.end()) udp_listen_port = atoi((++it)->c_str());
+	const bool udp_gro = std::find(args.begin(), args.end(), "--udp-gro") != args.end(); // --udp-gro : receive with UDP_GRO
+	int forward_batch = 32; // --forward-batch N : datagrams in one sendmmsg() / recvmmsg()
+	it = std::find(args.begin(), args.end(), "--forward-batch");
+	if (it != args.end()) forward_batch = atoi((++it)->c_str());
+	if (!forward_address.empty()) {
+		if (engine != "asio") throw std::invalid_argument("--forward reads the TUN itself, do not use it with --engine");
+		engine = "forward";
+		std::cout << "forward to " << forward_address << " port " << forward_port << ", batch " << forward_batch << '\n';
+	}
+
+	// --transform NAME : decode the payload (after marker, index and time) of each packet before checking, and the generator
+	// encodes it; xor, chacha20, or a given kernel like xor-sse2, chacha20-scalar (see make_transform)
+	std::unique_ptr<c_transform> transform;
+	it = std::find(args.begin(), args.end(), "--transform");
+	if (it != args.end()) {
+		string transform_key = "tuntest"; // --transform-key K
+		auto key_it = std::find(args.begin(), args.end(), "--transform-key");
+		if (key_it != args.end()) transform_key = *(++key_it);
+		transform = make_transform(*(++it), transform_key);
+		std::cout << "transform " << transform->get_name() << '\n';
+	}
+
+	// --verify : check UDP checksum, marker and the filler of each packet, and count corrupted ones
+	const bool verify = std::find(args.begin(), args.end(), "--verify") != args.end();
+
+	// --capture PATH : record the IP packets read into pcap file PATH, by a background writer (readers never wait for it);
+	// --capture-size MB : size of the file (64), when full it becomes PATH.1 and a new PATH starts;
+	// --capture-snaplen N : bytes of each packet to keep (0: headers only, at most 65535);
+	// --capture-ring MB : memory for the packets waiting for the writer (8), the bigger snaplen the less packets fit
+	std::unique_ptr<c_pcap_capture> capture;
+	it = std::find(args.begin(), args.end(), "--capture");
+	if (it != args.end()) {
+		const string capture_path = *(++it);
+		size_t capture_size_mb = 64;
+		auto option_it = std::find(args.begin(), args.end(), "--capture-size");
+		if (option_it != args.end()) capture_size_mb = atol((++option_it)->c_str());
+		size_t capture_snaplen = 0;
+		option_it = std::find(args.begin(), args.end(), "--capture-snaplen");
+		if (option_it != args.end()) capture_snaplen = atol((++option_it)->c_str());
+		size_t capture_ring_mb = c_pcap_capture::default_ring_bytes / (1024 * 1024);
+		option_it = std::find(args.begin(), args.end(), "--capture-ring");
+		if (option_it != args.end()) capture_ring_mb = atol((++option_it)->c_str());
+		capture.reset(new c_pcap_capture(capture_path, capture_size_mb * 1024 * 1024, capture_snaplen,
+			capture_ring_mb * 1024 * 1024));
+		std::cout << "capture to " << capture_path << '\n';
+	}
+
+	// --stats-file PATH [--stats-format json|csv] : write a stats snapshot every --stats-interval ms (1000) to the file;
+	// --prometheus-port N : serve the last snapshot in Prometheus text format on 127.0.0.1:N
+	c_stats_exporter stats_exporter;
+	bool stats_export = false;
+	it = std::find(args.begin(), args.end(), "--stats-file");
+	if (it != args.end()) {
+		string stats_format = "json";
+		auto format_it = std::find(args.begin(), args.end(), "--stats-format");
+		if (format_it != args.end()) stats_format = *(++format_it);
+		stats_exporter.open_file(*(++it), stats_format);
+		stats_export = true;
+	}
+	it = std::find(args.begin(), args.end(), "--prometheus-port");
+	if (it != args.end()) {
+		stats_exporter.serve_prometheus(static_cast<uint16_t>(atoi((++it)->c_str())));
+		stats_export = true;
+	}
+	int stats_interval_ms = 1000;
+	it = std::find(args.begin(), args.end(), "--stats-interval");
+	if (it != args.end()) stats_interval_ms = atoi((++it)->c_str());
+
+	// --device tun|loopback : loopback is an in-process stand-in for TUN that needs no privileges, fed by the generator
+	string device_type = "tun";
+	it = std::find(args.begin(), args.end(), "--device");
+	if (it != args.end()) device_type = *(++it);
+	// --devices K : K devices (each with --queues queues) run by one shared pool of -j threads (pinned by --cpus), as on
+	// a node that terminates many tunnels; device k gets --address with k added to its 4th group, and prefix 64
+	// (fd00:8080:8080:8080+k::/64), and the generator sends batch b to ::1 in the prefix of device b % K
+	int number_of_devices = 1;
+	it = std::find(args.begin(), args.end(), "--devices");
+	if (it != args.end()) number_of_devices = atoi((++it)->c_str());
+	if (number_of_devices < 1) throw std::invalid_argument("--devices must be at least 1");
+	const bool many_devices = number_of_devices > 1;
+	if (many_devices) {
+		if (engine != "asio") throw std::invalid_argument("--devices reads with the asio engine only");
+		if (io_service_per_queue) throw std::invalid_argument("--devices uses one shared thread pool, not --io-per-queue");
+		if (udp_listen_port) throw std::invalid_argument("--udp-listen needs one device");
+		if (!tun_address4.empty()) throw std::invalid_argument("--address4 needs one device");
+		std::cout << "devices " << number_of_devices << " on a shared pool of " << number_of_threads << " threads\n";
+	}
+	std::vector<std::array<uint8_t, 16>> device_addresses(number_of_devices, ip_address);
+	for (size_t device_nr = 0; many_devices && (device_nr < device_addresses.size()); ++device_nr) {
+		auto & address = device_addresses.at(device_nr);
+		const uint16_t group = static_cast<uint16_t>(((address.at(6) << 8) | address.at(7)) + device_nr);
+		address.at(6) = static_cast<uint8_t>(group >> 8);
+		address.at(7) = static_cast<uint8_t>(group);
+	}
+	std::vector<string> device_destinations; // with many devices, ::1 in the prefix of each device
+	for (size_t device_nr = 0; many_devices && (device_nr < device_addresses.size()); ++device_nr) {
+		std::array<uint8_t, 16> destination = device_addresses.at(device_nr);
+		std::fill(destination.begin() + 8, destination.end(), 0);
+		destination.back() = 1;
+		char text[INET6_ADDRSTRLEN];
+		device_destinations.push_back(inet_ntop(AF_INET6, destination.data(), text, sizeof(text)));
+	}
+	if (many_devices) {
+		tun_prefix = 64;
+		generator_destination = device_destinations.front();
+	}
+
+	// asio readers of the asio engine (filled below); before the devices, as the memory of their pending reads is freed
+	// only when the io_service of the device (or pool) is destroyed
+	std::vector<std::unique_ptr<c_read_loop>> read_loops;
+	std::vector<c_read_sequence> read_sequences((read_depth > 1) ? number_of_queues * number_of_devices : 0); // of each queue
+	std::unique_ptr<c_io_service_pool> io_pool; // with many devices, the threads that run all of them
+	if (many_devices) io_pool.reset(new c_io_service_pool(number_of_threads, placement));
+	std::vector<std::unique_ptr<c_device_asio>> devices;
+	if (device_type == "tun") {
+		std::vector<c_tun_device_linux_asio *> tun_devices;
+		for (int device_nr = 0; device_nr < number_of_devices; ++device_nr) {
+			if (io_pool) tun_devices.push_back(new c_tun_device_linux_asio(*io_pool, number_of_queues, offload));
+			else tun_devices.push_back(new c_tun_device_linux_asio(number_of_threads, number_of_queues, io_service_per_queue, offload,
+				placement));
+			devices.emplace_back(tun_devices.back());
+		}
+		c_tun_device_linux_asio::set_ipv6_all(tun_devices, device_addresses, tun_prefix, mtu); // few netlink messages for all
+	}
+	else if (device_type == "loopback") {
+		if (offload) throw std::invalid_argument("--offload needs --device tun");
+		if (udp_listen_port) throw std::invalid_argument("--udp-listen needs --device tun");
+		for (int device_nr = 0; device_nr < number_of_devices; ++device_nr) {
+			if (io_pool) devices.emplace_back(new c_loopback_device_asio(*io_pool, number_of_queues));
+			else devices.emplace_back(new c_loopback_device_asio(number_of_threads, number_of_queues, io_service_per_queue, placement));
+			devices.back()->set_ipv6(device_addresses.at(device_nr), tun_prefix, mtu);
+		}
+		if (generator_threads == 0) generator_threads = 1; // nothing else would write to it
+	}
+	else throw std::invalid_argument("unknown --device " + device_type);
+	c_device_asio & tun_device = *devices.front(); // the only one, unless --devices
+	if (!tun_address4.empty()) tun_device.add_ipv4(ip_address4, tun_prefix4);
 
 	c_counter counter    (std::chrono::seconds(1),true);
 	c_counter counter_big(std::chrono::seconds(3),true);
 	c_counter counter_all(std::chrono::seconds(999999),true);
 
-	c_packet_check packet_check(10*1000*1000);
+	size_t reorder_window = 64 * 1024; // --reorder-window N : how far back in packet indexes are duplicates/reorder tracked
+	it = std::find(args.begin(), args.end(), "--reorder-window");
+	if (it != args.end()) reorder_window = atol((++it)->c_str());
+	c_packet_check packet_check(reorder_window);
+	c_packet_stats packet_stats({ 1280, 1500, 9000, static_cast<size_t>(mtu) }); // sizes of IP packets read
+	c_packet_verify packet_verify; // used if verify
+	c_latency_recorder latency; // one-way delay from the send time that generator writes after the index
 
 //	auto loop = [&](){
 		std::cout << "Entering the event loop\n";
 
 		fd_set fd_set_data;
 
-		const int buf_size = config_buf_size;
-		unsigned char buf[buf_size];
-		std::vector<std::vector<unsigned char>> buffers_vector(number_of_threads, std::vector<unsigned char>(buf_size));
-
+		// one buffer per in-flight read; the completion owns it until the packet is parsed, then re-arms the read with it.
+		// Pool of each queue (of each device), on the NUMA node of its thread when a queue has own thread
+		std::vector<std::unique_ptr<c_buffer_pool>> buffer_pools;
+		for (size_t queue_nr = 0; queue_nr < static_cast<size_t>(number_of_queues) * devices.size(); ++queue_nr)
+			buffer_pools.emplace_back(new c_buffer_pool(buf_size, (engine == "asio") ? read_depth : 1,
+				io_service_per_queue ? placement.get_numa_node(queue_nr) : -1));
 
 		const bool dbg_tun_data=1;
-		int dbg_tun_data_nr = 0; // how many times we shown it
+		std::atomic<int> dbg_tun_data_nr(0); // how many times we shown it
 
 		bool warned_marker=false; // ever warned about marker yet?
 
 		size_t loop_nr=0;
 
-		tun_device.get_stream_descriptor().read_some(boost::asio::buffer(buf, sizeof(buf)));
-		std::function<void(const boost::system::error_code& error, std::size_t bytes_transferred)> write_lambda =
-			[&](const boost::system::error_code& error, std::size_t bytes_transferred) {
-			if (error) return;
-				tun_device.send_data_size += bytes_transferred;
-				tun_device.get_stream_descriptor().async_read_some(boost::asio::buffer(buf, sizeof(buf)), write_lambda);
-		}; // lambda
-		tun_device.get_stream_descriptor().async_read_some(boost::asio::buffer(buf, sizeof(buf)), write_lambda);
+		std::mutex dbg_tun_data_mutex; // only for the few first packets that we show
+		std::atomic<bool> limit_reached(false);
+		std::atomic<size_t> transform_bad(0); // packets that did not decode to the filler
 
-		while (1) {
-			++loop_nr;
-			ssize_t size_read_tun=0, size_read_udp=0;
-			const unsigned char xorpass=42;
-			int size_read = tun_device.send_data_size.exchange(0);
-			//size_read += read(m_tun_fd, buf, sizeof(buf));
-			//size_read += tun_device.get_stream_descriptor().read_some(boost::asio::buffer(buf, sizeof(buf)));
-			const int mark1_pos = 52;
+		// check one UDP payload of our test packet (marker, then packet index, then send time)
+		auto see_payload = [&](const unsigned char * buf, int size_read) {
+			const int mark1_pos = 0;
+			if (size_read < mark1_pos+2+1 + 4) return; // too short to be our test packet (e.g. ICMPv6 from the kernel)
 			bool mark_ok = true;
 			if (!(  (buf[mark1_pos]==100) && (buf[mark1_pos+1]==101) &&  (buf[mark1_pos+2]==102)  )) mark_ok=false;
+			if (verify && !mark_ok) { // the index of such packet means nothing
+				packet_verify.see_bad_marker();
+				return;
+			}
 
 			{ // validate counter 1
-				long int packet_index=0;
-				for (int i=0; i<4; ++i) packet_index += static_cast<size_t>(buf[mark1_pos+2+1 +i]) << (8*i);
+				uint32_t packet_index_low=0;
+				for (int i=0; i<4; ++i) packet_index_low += static_cast<uint32_t>(buf[mark1_pos+2+1 +i]) << (8*i);
+				const uint64_t packet_index = packet_check.unwrap_index(packet_index_low); // the index on wire is only 32 bit
 				// _info("packet_index " << packet_index);
 
-				if (packet_index >= global_config_end_after_packet ) {
-					cout << "LIMIT - END " << endl << endl;
-					std::cout << "Limit - ending test\n";
-					break ;
+				if (packet_index >= end_after_packet ) {
+					limit_reached = true;
+					return;
 				} // <====== RET
 
 				packet_check.see_packet(packet_index);
-				//			packet_stats.see_size( size_read ); // TODO
+
+				const int header_size = c_generator::payload_header_size;
+				if (transform && (size_read > header_size)) { // decode into own buffer, read buffer stays as it came
+					thread_local std::vector<unsigned char> decoded(buf_size);
+					const size_t filler_size = size_read - header_size;
+					transform->apply(buf + header_size, decoded.data(), filler_size, packet_index_low);
+					if (verify) packet_verify.see_filler(decoded.data(), filler_size);
+					else if ((decoded.at(0) != 'x') || (decoded.at(filler_size - 1) != 'x')) ++transform_bad;
+				}
+				else if (verify && (size_read > header_size)) packet_verify.see_filler(buf + header_size, size_read - header_size);
+			}
+			if (size_read >= mark1_pos+2+1 + 4 + 8) { // send time, CLOCK_MONOTONIC so valid on same host only
+				uint64_t time_sent=0;
+				for (int i=0; i<8; ++i) time_sent += static_cast<uint64_t>(buf[mark1_pos+2+1+4 +i]) << (8*i);
+				const uint64_t time_now = get_monotonic_ns();
+				if (time_sent && (time_sent <= time_now)) latency.record(time_now - time_sent);
 			}
 /*			if ( buf[size_read-10] != 'X') {
 				if (!warned_marker) std::cout << "Wrong marker X\n";
@@ -257,34 +387,332 @@ int main(int argc, char **argv) {
 
 			//		if (!mark_ok) _info("Packet has not expected UDP data! (wrong data read from TUN?) other then "
 			//			"should be sent by our ipclient test program");
+			(void)mark_ok;
+		};
+
+		// parse and check one read from TUN, called from the completion that owns buf; returns number of segments in it
+		const int pi_size = 4; // the struct tun_pi, we do not use IFF_NO_PI
+		auto see_packet_data = [&](const unsigned char * buf, int size_read) -> size_t {
+			size_t segments = 1;
+			if (offload) {
+				if (size_read < pi_size) return segments;
+				c_vnet_packet packet(buf + pi_size, size_read - pi_size);
+				if (packet.is_valid()) packet_stats.see_size(packet.get_ip_packet_size());
+				if (capture && packet.is_valid()) capture->see_packet(packet.get_ip_packet(), packet.get_ip_packet_size());
+				if (verify && packet.is_valid() && packet.is_udp()) { // GSO segments and offloaded checksums can not be checked
+					const c_ip_packet ip(packet.get_ip_packet(), packet.get_ip_packet_size());
+					if (packet.is_gso() || packet.is_checksum_partial() || !ip.is_udp()) packet_verify.see_unverifiable();
+					else packet_verify.see_udp_packet(ip);
+				}
+				packet.for_each_udp_payload(see_payload);
+				segments = packet.get_segment_count();
+			} else if (size_read > pi_size) {
+				packet_stats.see_size(size_read - pi_size);
+				if (capture) capture->see_packet(buf + pi_size, size_read - pi_size);
+				const c_ip_packet packet(buf + pi_size, size_read - pi_size);
+				if (packet.is_udp()) {
+					if (verify) packet_verify.see_udp_packet(packet);
+					see_payload(packet.get_udp_payload(), packet.get_udp_payload_size());
+				} else {
+					const uint8_t proto = packet.get_l4_proto();
+					const bool known = packet.is_valid() && ((proto == IPPROTO_UDP) || (proto == IPPROTO_TCP)
+						|| (proto == IPPROTO_ICMP) || (proto == IPPROTO_ICMPV6)); // ICMP errors quote our packets, do not count them
+					if (!known) { // unknown layout (tunneled, not IP...), look for the marker
+						const unsigned char * marker = find_marker(buf, size_read, c_generator::marker);
+						if (marker) see_payload(marker, static_cast<int>(buf + size_read - marker));
+					}
+				}
+			}
 
-			if (dbg_tun_data && dbg_tun_data_nr<5) {
-				++dbg_tun_data_nr;
+			if (dbg_tun_data && dbg_tun_data_nr.load(std::memory_order_relaxed)<5) {
+				std::lock_guard<std::mutex> lg(dbg_tun_data_mutex);
+				if (dbg_tun_data_nr++ >= 5) return segments;
 				// _info("Read: " << size_read);
 				auto show = std::min(size_read,128); // show the data read, but not more then some part
-				auto start_pos=0;
-				for (int i=0; i<show; ++i) {
-					cout << static_cast<unsigned int>(buf[i]) << ' ';
-					if ((buf[i]==100) && (buf[i+1]==101) && (buf[i+2]==102)) start_pos = i;
-				}
+				for (int i=0; i<show; ++i) cout << static_cast<unsigned int>(buf[i]) << ' ';
+				const unsigned char * marker = find_marker(buf, size_read, c_generator::marker);
+				const auto start_pos = marker ? marker - buf : -1;
 				std::cout << "size_read=" << size_read << " start_pos=" << start_pos << '\n';
 
 				cout << endl << endl;
 				// buf[buf_size-1]='\0'; // hack. terminate sting to print it:
 				// cout << "Buf=[" << string( reinterpret_cast<char*>(static_cast<unsigned char*>(&buf[0])), size_read) << "] buf_size="<< buf_size << endl;
 			}
+			return segments;
+		};
+
+		// accounting of one packet read from a queue with these stats, same for all engines
+		auto on_packet = [&](c_tun_queue_stats & queue_stats, const unsigned char * buf, size_t bytes_transferred) {
+			const size_t segments = see_packet_data(buf, bytes_transferred);
+			queue_stats.add_packet(bytes_transferred, segments);
+		};
+
+		// read_depth readers per queue of each device, each re-arms its read from the completion without allocating
+		for (size_t reader_nr = 0; (engine == "asio") && (reader_nr < number_of_queues * devices.size()); ++reader_nr) {
+			c_device_asio & device = *devices.at(reader_nr / number_of_queues);
+			const size_t queue_nr = reader_nr % number_of_queues;
+			auto & queue_stats = device.get_queue_stats(queue_nr);
+			c_read_sequence * sequence = (read_depth > 1) ? &read_sequences.at(reader_nr) : nullptr;
+			for (int depth_nr = 0; depth_nr < read_depth; ++depth_nr) {
+				read_loops.emplace_back(new c_read_loop(device.get_stream_descriptor(queue_nr), buffer_pools.at(reader_nr)->acquire(),
+					buf_size, [&on_packet, &queue_stats](const unsigned char * buf, size_t size) { on_packet(queue_stats, buf, size); },
+					sequence));
+				read_loops.back()->start();
+			}
+		}
+
+		std::atomic<bool> uring_stop(false);
+		std::vector<std::unique_ptr<c_uring_rx>> uring_readers;
+		std::vector<std::thread> uring_threads;
+		for (size_t queue_nr = 0; (engine == "uring") && (queue_nr < tun_device.get_number_of_queues()); ++queue_nr) {
+			const int fd = tun_device.get_stream_descriptor(queue_nr).native_handle();
+			auto & queue_stats = tun_device.get_queue_stats(queue_nr);
+			uring_readers.emplace_back(new c_uring_rx(fd, uring_depth, buf_size,
+				[&on_packet, &queue_stats](const unsigned char * buf, size_t size) { on_packet(queue_stats, buf, size); },
+				placement.get_numa_node(queue_nr)));
+			auto & reader = *uring_readers.back();
+			uring_threads.emplace_back([&reader, &uring_stop, &limit_reached, &placement, queue_nr] {
+				std::cout << "start uring thread\n";
+				placement.apply(queue_nr);
+				try {
+					reader.run(uring_stop);
+				} catch (const std::exception &error) { // end the test, so that the other queues and the report finish
+					std::cerr << "queue " << queue_nr << ": " << error.what() << std::endl;
+					uring_stop = true;
+					limit_reached = true;
+				}
+			});
+		}
+
+		std::atomic<bool> poll_stop(false);
+		std::vector<std::unique_ptr<c_busy_poll_rx>> poll_readers;
+		std::vector<std::thread> poll_threads;
+		for (size_t queue_nr = 0; (engine == "poll") && (queue_nr < tun_device.get_number_of_queues()); ++queue_nr) {
+			const int fd = tun_device.get_stream_descriptor(queue_nr).native_handle();
+			auto & queue_stats = tun_device.get_queue_stats(queue_nr);
+			poll_readers.emplace_back(new c_busy_poll_rx(fd, buf_size, poll_spin,
+				[&on_packet, &queue_stats](const unsigned char * buf, size_t size) { on_packet(queue_stats, buf, size); },
+				placement.get_numa_node(queue_nr)));
+			auto & reader = *poll_readers.back();
+			poll_threads.emplace_back([&reader, &poll_stop, &limit_reached, &placement, queue_nr] {
+				std::cout << "start busy poll thread\n";
+				placement.apply(queue_nr);
+				try {
+					reader.run(poll_stop);
+				} catch (const std::exception &error) { // end the test, so that the other queues and the report finish
+					std::cerr << "queue " << queue_nr << ": " << error.what() << std::endl;
+					poll_stop = true;
+					limit_reached = true;
+				}
+			});
+		}
+
+		// forward mode: TUN -> UDP thread for each queue, and one UDP -> TUN thread
+		std::atomic<bool> forward_stop(false);
+		std::unique_ptr<c_udp_forwarder> forwarder;
+		std::vector<std::thread> forward_threads;
+		c_tun_queue_stats udp_stats; // frames received from the UDP peer
+		if (!forward_address.empty() || udp_listen_port) {
+			forwarder.reset(new c_udp_forwarder(udp_listen_port, forward_batch, buf_size, udp_gro));
+			if (udp_listen_port) std::cout << "UDP listen on port " << udp_listen_port << (udp_gro ? " (GRO)" : "") << '\n';
+			for (size_t queue_nr = 0; (!forward_address.empty()) && (queue_nr < tun_device.get_number_of_queues()); ++queue_nr) {
+				if (queue_nr == 0) forwarder->set_peer(forward_address, forward_port);
+				const int fd = tun_device.get_stream_descriptor(queue_nr).native_handle();
+				forward_threads.emplace_back([&, fd, queue_nr] {
+					placement.apply(queue_nr);
+					auto & queue_stats = tun_device.get_queue_stats(queue_nr);
+					forwarder->run_tun_to_udp(fd, forward_stop,
+						[&on_packet, &queue_stats](const unsigned char * buf, size_t size) { on_packet(queue_stats, buf, size); });
+				});
+			}
+			if (udp_listen_port) {
+				const int fd = tun_device.get_stream_descriptor(0).native_handle();
+				const size_t thread_nr = forward_threads.size();
+				forward_threads.emplace_back([&, fd, thread_nr] {
+					placement.apply(thread_nr);
+					forwarder->run_udp_to_tun(fd, forward_stop,
+						[&](const unsigned char * buf, size_t size) { udp_stats.add_packet(size, see_packet_data(buf, size)); });
+				});
+			}
+		}
+
+		std::unique_ptr<c_generator> generator;
+		if (generator_threads > 0) {
+			std::cout << "generator: " << generator_threads << " threads, batch " << generator_batch
+				<< ", payload " << generator_size << " to " << generator_destination << '\n';
+			generator.reset(new c_generator(generator_destination, 9000, generator_size, generator_batch, generator_threads));
+			std::vector<int> source_fds;
+			for (const auto & device : devices)
+				for (size_t queue_nr = 0; queue_nr < device->get_number_of_queues(); ++queue_nr)
+					if (device->get_source_fd(queue_nr) >= 0) source_fds.push_back(device->get_source_fd(queue_nr));
+			for (size_t device_nr = 1; device_nr < device_destinations.size(); ++device_nr)
+				generator->add_destination(device_destinations.at(device_nr));
+			if (!source_fds.empty()) generator->set_frame_output(source_fds);
+			if (transform) generator->set_transform(transform.get());
+			generator->start(end_after_packet);
+		}
 
-			size_read_tun += size_read;
+		// the main thread is the reporter: it wakes up on a timer, sums the per-queue stats and prints; readers never wait for it
+		boost::asio::io_service reporter_io_service;
+		boost::asio::steady_timer reporter_timer(reporter_io_service);
+		const auto reporter_interval = std::chrono::milliseconds(100); // less then the shortest window; and how fast we notice the end
+		size_t reported_packets = 0, reported_bytes = 0; // sums at the previous report
+
+		// snapshot for the stats export, made by the reporter
+		c_histogram latency_exported; // all latencies at the previous export, the percentiles are of the interval since it
+		auto make_metrics = [&]() -> t_metrics {
+			size_t segments = udp_stats.get_totals().m_segments;
+			for (const auto & device : devices) segments += device->get_stats_totals().m_segments;
+			const auto check = packet_check.get_totals();
+			const auto sizes = packet_stats.get_totals();
+			c_histogram latency_all = latency.get_merged();
+			c_histogram latency_interval = latency_all;
+			latency_interval.subtract(latency_exported);
+			latency_exported = std::move(latency_all);
+			const double us = 1000;
+
+			t_metrics metrics = {
+				{ "time_seconds", std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count(), false,
+					"Unix time of the snapshot" },
+				{ "run_seconds", counter_all.get_time_all(), false, "Time from the first packet read" },
+				{ "packets_total", static_cast<double>(reported_packets), true, "Reads from the device (GSO super-packet is one)" },
+				{ "segments_total", static_cast<double>(segments), true, "Packets on the wire (each GSO segment)" },
+				{ "bytes_total", static_cast<double>(reported_bytes), true, "Bytes read from the device" },
+				{ "check_unique_total", static_cast<double>(check.m_count_uniq), true, "Test packets seen first time" },
+				{ "check_duplicate_total", static_cast<double>(check.m_count_dupli), true, "Test packets seen again" },
+				{ "check_reordered_total", static_cast<double>(check.m_count_reord), true, "Test packets older then the newest one" },
+				{ "check_late_total", static_cast<double>(check.m_count_late), true, "Test packets older then the reorder window" },
+				{ "check_lost_total", static_cast<double>(packet_check.get_count_lost()), true, "Indexes that left the window unseen" },
+				{ "check_missing", static_cast<double>(packet_check.get_missing()), false, "Indexes not seen up to the max index" },
+				{ "check_max_index", static_cast<double>(packet_check.get_max_index()), false, "Highest test packet index seen" },
+				{ "size_bytes_total", static_cast<double>(sizes.m_bytes), true, "Sum of IP packet sizes" },
+				{ "size_packets_total", static_cast<double>(sizes.m_count), true, "IP packets counted in sizes" },
+				{ "latency_packets", static_cast<double>(latency_interval.get_count()), false, "Latencies since previous snapshot" },
+				{ "latency_p50_us", latency_interval.get_percentile(50) / us, false, "Latency since previous snapshot" },
+				{ "latency_p99_us", latency_interval.get_percentile(99) / us, false, "Latency since previous snapshot" },
+				{ "latency_p999_us", latency_interval.get_percentile(99.9) / us, false, "Latency since previous snapshot" },
+				{ "latency_p9999_us", latency_interval.get_percentile(99.99) / us, false, "Latency since previous snapshot" },
+				{ "latency_max_us", latency_interval.get_max() / us, false, "Latency since previous snapshot" },
+			};
+			if (capture) {
+				metrics.push_back({ "capture_packets_total", static_cast<double>(capture->get_count_captured()), true,
+					"Packets written to the capture file" });
+				metrics.push_back({ "capture_dropped_total", static_cast<double>(capture->get_count_dropped()), true,
+					"Packets not captured, the writer was behind" });
+			}
+			if (verify) {
+				const auto verified = packet_verify.get_totals();
+				metrics.push_back({ "verify_checksum_ok_total", static_cast<double>(verified.m_count_checksum_ok), true, "UDP checksum ok" });
+				metrics.push_back({ "verify_checksum_bad_total", static_cast<double>(verified.m_count_checksum_bad), true, "UDP checksum bad" });
+				metrics.push_back({ "verify_unverifiable_total", static_cast<double>(verified.m_count_unverifiable), true,
+					"Packets without checksum to check" });
+				metrics.push_back({ "verify_marker_bad_total", static_cast<double>(verified.m_count_marker_bad), true, "Payloads without marker" });
+				metrics.push_back({ "verify_pattern_bad_total", static_cast<double>(verified.m_count_pattern_bad), true, "Payloads with bad filler" });
+			}
+			return metrics;
+		};
+		// with many devices: how evenly the shared threads served them since the previous print
+		std::vector<size_t> device_reported_packets(devices.size(), 0);
+		auto print_devices_window = [&]() {
+			size_t min = std::numeric_limits<size_t>::max(), max = 0, sum = 0, idle = 0;
+			for (size_t device_nr = 0; device_nr < devices.size(); ++device_nr) {
+				const size_t packets = devices.at(device_nr)->get_stats_totals().m_packets;
+				const size_t window = packets - device_reported_packets.at(device_nr);
+				device_reported_packets.at(device_nr) = packets;
+				min = std::min(min, window);
+				max = std::max(max, window);
+				sum += window;
+				if (window == 0) ++idle;
+			}
+			std::cout << "Devices: " << devices.size() << "; pck per device min " << min << " avg " << sum / devices.size()
+				<< " max " << max << "; idle " << idle << std::endl;
+		};
+		auto stats_next_export = std::chrono::steady_clock::now();
+		std::function<void(const boost::system::error_code& error)> report = [&](const boost::system::error_code& error) {
+			if (error) return;
+			++loop_nr;
+			size_t packets = 0, bytes = 0;
+			for (const auto & device : devices) {
+				const auto totals = device->get_stats_totals();
+				packets += totals.m_packets;
+				bytes += totals.m_bytes;
+			}
+			const auto udp_totals = udp_stats.get_totals();
+			packets += udp_totals.m_packets;
+			bytes += udp_totals.m_bytes;
+			for (c_counter * each : { &counter, &counter_big, &counter_all })
+				each->add(packets - reported_packets, bytes - reported_bytes);
+			reported_packets = packets;
+			reported_bytes = bytes;
 
 			bool printed=false;
-			printed = printed || counter.tick(size_read_tun, std::cout);
-			bool printed_big = counter_big.tick(size_read_tun, std::cout);
+			printed = printed || counter.tick(std::cout);
+			if (printed) packet_stats.print_window(std::cout);
+			bool printed_big = counter_big.tick(std::cout);
 			printed = printed || printed_big;
-			if (printed_big) packet_check.print();
-			counter_all.tick(size_read_tun, std::cout, true);
-		} // while
+			if (printed_big) {
+				if (many_devices) print_devices_window();
+				packet_check.print();
+				if (verify) packet_verify.print(std::cout);
+				latency.print_window(std::cout);
+			}
+			counter_all.tick(std::cout, true);
+
+			if (stats_export && (limit_reached || (std::chrono::steady_clock::now() >= stats_next_export))) {
+				stats_exporter.export_snapshot(make_metrics());
+				stats_next_export += std::chrono::milliseconds(stats_interval_ms);
+			}
+
+			if (limit_reached) {
+				cout << "LIMIT - END " << endl << endl;
+				std::cout << "Limit - ending test\n";
+				return;
+			} // <====== RET, timer is not armed again so the reporter loop ends
+
+			reporter_timer.expires_at(reporter_timer.expiry() + reporter_interval);
+			reporter_timer.async_wait(report);
+		};
+		if (stats_cpu >= 0) { // only now, so that threads started above do not inherit it
+			pin_this_thread(stats_cpu);
+			std::cout << "reporter on CPU " << stats_cpu << '\n';
+		}
+		reporter_timer.expires_after(reporter_interval);
+		reporter_timer.async_wait(report);
+		reporter_io_service.run();
 
 		std::cout << "Loop done\n";
+		// no asio handler may run after this: they use the buffers, checkers and lambdas above, declared after the devices
+		if (io_pool) io_pool->stop();
+		for (auto & device : devices) device->stop();
+		if (generator) {
+			generator->join();
+			std::cout << "generator sent " << generator->get_sent_packets() << " pck\n";
+		}
+		forward_stop = true;
+		for (auto & thread : forward_threads) thread.join();
+		if (forwarder) forwarder->print_stats(std::cout);
+		size_t read_loop_heap = 0, read_out_of_order = 0;
+		for (const auto & reader : read_loops) read_loop_heap += reader->get_count_heap_allocations();
+		for (const auto & sequence : read_sequences) read_out_of_order += sequence.get_count_out_of_order();
+		if (!read_loops.empty())
+			std::cout << "asio read loops: " << read_loops.size() << " (depth " << read_depth << "), " << read_loop_heap
+				<< " handler allocations from heap, " << read_out_of_order << " reads completed out of posting order\n";
+		uring_stop = true;
+		for (auto & thread : uring_threads) thread.join();
+		for (size_t queue_nr = 0; queue_nr < uring_readers.size(); ++queue_nr) {
+			const auto & reader = *uring_readers.at(queue_nr);
+			std::cout << "Queue " << queue_nr << " io_uring: " << reader.get_count_packets() << " pck in "
+				<< reader.get_count_enter() << " io_uring_enter calls\n";
+		}
+		poll_stop = true;
+		for (auto & thread : poll_threads) thread.join();
+		for (size_t queue_nr = 0; queue_nr < poll_readers.size(); ++queue_nr) {
+			const auto & reader = *poll_readers.at(queue_nr);
+			std::cout << "Queue " << queue_nr << " busy poll: " << reader.get_count_packets() << " pck, "
+				<< reader.get_count_empty_reads() << " empty reads, " << reader.get_count_sleeps() << " sleeps in poll()\n";
+		}
+		// all readers are stopped now (asio threads, forward, io_uring and poll threads), none can call see_packet any more
+		if (capture) capture->stop(); // writes the rest of the ring, so the counts are final
 //	};
 /*	if (number_of_threads > 10 && number_of_threads > 0)
 		number_of_threads = 1;
@@ -300,6 +728,24 @@ int main(int argc, char **argv) {
 */
 	std::cout << endl << endl;
 	counter_all.print(std::cout);
+	if (many_devices) {
+		size_t packets_sum = 0, segments_sum = 0, bytes_sum = 0;
+		for (size_t device_nr = 0; device_nr < devices.size(); ++device_nr) {
+			const auto totals = devices.at(device_nr)->get_stats_totals();
+			std::cout << "Device " << device_nr << ": " << totals.m_packets << " pck; " << totals.m_segments << " segments; "
+				<< totals.m_bytes << " bytes\n";
+			packets_sum += totals.m_packets;
+			segments_sum += totals.m_segments;
+			bytes_sum += totals.m_bytes;
+		}
+		std::cout << "All devices: " << packets_sum << " pck; " << segments_sum << " segments; " << bytes_sum << " bytes" << std::endl;
+	}
+	else tun_device.print_queue_stats(std::cout);
+	if (transform) std::cout << "Transform " << transform->get_name() << ": " << transform_bad << " pck did not decode\n";
+	packet_stats.print(std::cout);
 	packet_check.print();
+	if (verify) packet_verify.print(std::cout);
+	latency.print(std::cout);
+	if (capture) capture->print(std::cout);
 	return 0;
 }
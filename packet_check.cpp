@@ -0,0 +1,165 @@
+#include "packet_check.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+c_packet_check::c_counts::c_counts()
+	: m_count_dupli(0), m_count_uniq(0), m_count_reord(0), m_count_late(0)
+{ }
+
+void c_packet_check::c_counts::add(std::atomic<uint64_t> & counter) {
+	counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); // we are the only writer
+}
+
+c_packet_check::c_packet_check(size_t reorder_window)
+	: m_window_word(0), m_max_index(0), m_any_seen(false), m_count_lost(0), m_count_dupli_warned(0), m_i_thought_lost(false)
+{
+	size_t words = 2;
+	while (words * bits_per_word < reorder_window) words *= 2;
+	std::vector<std::atomic<uint64_t>> seen(words); // all tag 0 and empty: words 0..words-1 in first round
+	for (auto & word : seen) word = 0;
+	m_seen.swap(seen);
+}
+
+c_packet_check::c_totals c_packet_check::get_totals() const {
+	c_totals sum{ 0, 0, 0, 0 };
+	m_counts.for_each([&sum](const c_counts & counts) {
+		sum.m_count_dupli += counts.m_count_dupli.load(std::memory_order_relaxed);
+		sum.m_count_uniq += counts.m_count_uniq.load(std::memory_order_relaxed);
+		sum.m_count_reord += counts.m_count_reord.load(std::memory_order_relaxed);
+		sum.m_count_late += counts.m_count_late.load(std::memory_order_relaxed);
+	});
+	return sum;
+}
+
+uint64_t c_packet_check::get_max_index() const {
+	return m_max_index.load();
+}
+
+uint64_t c_packet_check::get_count_lost() const {
+	return m_count_lost.load();
+}
+
+bool c_packet_check::packets_maybe_lost() const {
+	size_t max_reodrder = 1000; // if more packets are out then it's probably lost.
+	// do we have packet-index much higher then number of packets recevied at all:
+	if (get_missing() > max_reodrder) {
+		m_i_thought_lost = true;
+		return true;
+	}
+	return false;
+}
+
+uint64_t c_packet_check::get_missing() const {
+	if (!m_any_seen) return 0;
+	const c_totals counts = get_totals();
+	const uint64_t came = counts.m_count_uniq + counts.m_count_late;
+	const uint64_t expected = m_max_index.load() + 1;
+	return (expected > came) ? (expected - came) : 0; // counters of threads are read one by one, so can be a bit off
+}
+
+uint64_t c_packet_check::unwrap_index(uint32_t packet_index_low) const {
+	const uint64_t max_index = m_max_index.load(std::memory_order_relaxed);
+	const uint64_t candidate = (max_index & ~uint64_t(0xFFFFFFFF)) | packet_index_low;
+	const uint64_t half = uint64_t(1) << 31;
+	if ((candidate > max_index) && (candidate - max_index > half) && (candidate >= (uint64_t(1) << 32)))
+		return candidate - (uint64_t(1) << 32); // from before the wrap
+	if ((candidate < max_index) && (max_index - candidate > half))
+		return candidate + (uint64_t(1) << 32); // already after the wrap
+	return candidate;
+}
+
+uint64_t c_packet_check::tag_of(uint64_t word) const {
+	return ((word / m_seen.size()) & 0xFF) << bits_per_word;
+}
+
+void c_packet_check::advance_window(uint64_t newest_word) {
+	std::lock_guard<std::mutex> lg(m_advance_mutex);
+	const uint64_t words = m_seen.size();
+	const uint64_t window_word = m_window_word.load(std::memory_order_relaxed); // only we change it
+	if (newest_word < window_word + words) return; // other thread moved it already
+	const uint64_t new_window_word = newest_word - words + 1;
+
+	// re-tag slots of the words that enter the window, counting not-seen packets of the words that were there as lost;
+	// this is done before the new window is published, so readers that see the new window find the slots ready
+	const uint64_t leaving = new_window_word - window_word;
+	const uint64_t entering = std::min(leaving, words);
+	uint64_t lost = (leaving - entering) * bits_per_word; // words that were never in the window at all
+	for (uint64_t word = new_window_word + words - entering; word < new_window_word + words; ++word) {
+		const uint64_t old = m_seen[word & (words - 1)].exchange(tag_of(word), std::memory_order_acq_rel);
+		// the slot held the word of the old window that falls on it (not word - words, if we jump more then a window)
+		const uint64_t old_word = window_word + ((word - window_word) & (words - 1));
+		if ((old & ~data_mask) == tag_of(old_word)) lost += bits_per_word - __builtin_popcountll(old & data_mask);
+		else lost += bits_per_word;
+	}
+	m_count_lost.fetch_add(lost, std::memory_order_relaxed);
+	m_window_word.store(new_window_word, std::memory_order_release);
+}
+
+void c_packet_check::see_late() {
+	// older then the window, so it was counted as lost. A duplicate of such old packet can not be told apart,
+	// we assume it is the lost one coming late (reorder deeper then the window)
+	c_counts & counts = m_counts.local();
+	counts.add(counts.m_count_late);
+	uint64_t lost = m_count_lost.load(std::memory_order_relaxed);
+	while ((lost > 0) && !m_count_lost.compare_exchange_weak(lost, lost - 1, std::memory_order_relaxed)) { }
+}
+
+void c_packet_check::see_packet(uint64_t packet_index) {
+	c_counts & counts = m_counts.local();
+	uint64_t max_index = m_max_index.load(std::memory_order_relaxed);
+	if (packet_index < max_index) counts.add(counts.m_count_reord);
+	while ((packet_index > max_index) && !m_max_index.compare_exchange_weak(max_index, packet_index, std::memory_order_relaxed)) { }
+	if (!m_any_seen.load(std::memory_order_relaxed)) m_any_seen = true;
+
+	const uint64_t words = m_seen.size();
+	const uint64_t word = packet_index / bits_per_word;
+	const uint64_t mask = uint64_t(1) << (packet_index % bits_per_word);
+	const uint64_t window_word = m_window_word.load(std::memory_order_acquire);
+	if (word < window_word) { see_late(); return; }
+	if (word >= window_word + words) advance_window(word);
+
+	// set our bit only while the slot is tagged for our word, in one CAS with the check: if the window moved past our
+	// word while we were here, the slot is already for a newer word and its bits belong to other packets
+	std::atomic<uint64_t> & slot = m_seen[word & (words - 1)];
+	const uint64_t tag = tag_of(word);
+	uint64_t old = slot.load(std::memory_order_acquire);
+	do {
+		if ((old & ~data_mask) != tag) { see_late(); return; }
+		if (old & mask) break; // duplicate, nothing to set
+	} while (!slot.compare_exchange_weak(old, old | mask, std::memory_order_acq_rel, std::memory_order_acquire));
+
+	if (old & mask) {
+		counts.add(counts.m_count_dupli);
+		const uint64_t warned = m_count_dupli_warned.fetch_add(1, std::memory_order_relaxed); // only on duplicates, so rare
+		const size_t warn_max = 100;
+		if (warned < warn_max)	{
+			std::cout << "duplicate at packet_index=" << packet_index << '\n';
+		}
+		if (warned == warn_max)	std::cout << "duplicate at packet_index - will hide further warnings\n";
+	} else { // a not-before-seen packet index
+		counts.add(counts.m_count_uniq);
+	}
+}
+
+void c_packet_check::print() const {
+	const c_totals counts = get_totals();
+	const uint64_t max_index = m_max_index.load();
+	auto missing = get_missing(); // mising now. maybe will come in a moment as reordered, or maybe are really lost
+	double missing_part = 0;
+	if (m_any_seen) missing_part = (double)missing / (max_index + 1);
+	auto & out = std::cout;
+	out << "Packets: uniq="<<counts.m_count_uniq/1000<<"K ; Max="<<max_index
+		<<" Dupli="<<counts.m_count_dupli
+		<<" Reord="<<counts.m_count_reord
+		<<" Late="<<counts.m_count_late
+		<<" Lost="<<m_count_lost
+		<<" Missing(now)=" << missing << " "
+		<< std::setw(3) << std::setprecision(2) << std::fixed << missing_part*100. << "%";
+
+	if (packets_maybe_lost()) out<<" LOST-PACKETS ";
+	else if (m_i_thought_lost) out<<" (packet seemed lost in past, but now all looks fine)";
+
+	out<<std::endl;
+}
+
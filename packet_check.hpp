@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "thread_slots.hpp"
+
+/// Were all packets received in order? Can be used from many reader threads at once, without locking per packet.
+/// Remembers which packet indexes were seen in a sliding window of the newest indexes: a ring of 64-bit words shared by
+/// all threads and set by compare-and-swap (that also checks the tag), so memory is constant no matter how long the
+/// test runs.
+/// Each word holds 56 packets and, in the top 8 bits, a tag telling which round of the ring it is for.
+/// Packets that fall behind the window are counted as lost when the window moves past them;
+/// if one of them arrives after that, it is counted as late (and not lost).
+/// Counters are kept per thread, and summed when read.
+class c_packet_check {
+	public:
+		c_packet_check(size_t reorder_window); ///< reorder_window - how many packets back we remember (at least)
+
+		void see_packet(uint64_t packet_index);
+		/// the 64-bit index, nearest to the max index seen so far, that has these lower 32 bits (as on the wire)
+		uint64_t unwrap_index(uint32_t packet_index_low) const;
+
+		void print() const;
+		bool packets_maybe_lost() const; ///< do we think now that some packets were lost?
+		uint64_t get_missing() const; ///< missing now: lost, or maybe will come in a moment as reordered
+
+		/// the counters, summed from all threads
+		struct c_totals {
+			uint64_t m_count_dupli;
+			uint64_t m_count_uniq;
+			uint64_t m_count_reord;
+			uint64_t m_count_late; ///< packets that came after the window moved past them (counted as lost before)
+		};
+		c_totals get_totals() const;
+
+		uint64_t get_max_index() const;
+		uint64_t get_count_lost() const;
+
+	private:
+		/// counters of one thread
+		struct c_counts {
+			c_counts();
+			std::atomic<uint64_t> m_count_dupli;
+			std::atomic<uint64_t> m_count_uniq;
+			std::atomic<uint64_t> m_count_reord;
+			std::atomic<uint64_t> m_count_late;
+			void add(std::atomic<uint64_t> & counter); ///< +1 on a counter of this thread's slot
+		};
+
+		static const unsigned bits_per_word = 56;
+		static const uint64_t data_mask = (uint64_t(1) << bits_per_word) - 1;
+
+		std::vector<std::atomic<uint64_t>> m_seen; ///< bit per packet index in the window, and the tag: was this packet seen yet
+		std::atomic<uint64_t> m_window_word; ///< the oldest word in window is for indexes from m_window_word*bits_per_word
+		std::mutex m_advance_mutex; ///< one thread at time moves the window (once per many packets, not per packet)
+		std::atomic<uint64_t> m_max_index;
+		std::atomic<bool> m_any_seen; ///< was any packet seen yet
+		std::atomic<uint64_t> m_count_lost; ///< packets not seen until the window moved past them
+		std::atomic<uint64_t> m_count_dupli_warned; ///< how many duplicates we warned about
+		mutable std::atomic<bool> m_i_thought_lost; ///< we thought packets are lost
+		c_thread_slots<c_counts> m_counts;
+
+		uint64_t tag_of(uint64_t word) const; ///< the tag (in the top bits) of ring slot, when it holds word
+		void advance_window(uint64_t newest_word); ///< move window so it ends at least with word newest_word
+		void see_late(); ///< a packet came from before the window
+};
+
@@ -0,0 +1,133 @@
+#include "packet_stats.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+constexpr size_t c_packet_stats::max_buckets;
+
+namespace {
+void add(std::atomic<uint64_t> & counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); // we are the only writer
+}
+}
+
+c_packet_stats::c_thread_data::c_thread_data()
+	: m_bytes(0), m_min(UINT64_MAX), m_max(0), m_window(UINT64_MAX), m_window_min(0), m_window_max(0)
+{
+	for (auto & count : m_counts) count = 0;
+}
+
+c_packet_stats::c_packet_stats(const std::vector<size_t> &mtus)
+	: m_window(0)
+{
+	for (size_t size = 64; size <= 64 * 1024; size *= 2) m_limits.push_back(size);
+	for (size_t mtu : mtus) if (mtu > 0) m_limits.push_back(mtu);
+	std::sort(m_limits.begin(), m_limits.end());
+	m_limits.erase(std::unique(m_limits.begin(), m_limits.end()), m_limits.end());
+	m_limits.push_back(SIZE_MAX);
+	if (m_limits.size() > max_buckets) throw std::invalid_argument("too many MTU sizes for c_packet_stats");
+	m_last_window = get_totals();
+}
+
+size_t c_packet_stats::bucket_of(size_t size) const {
+	return std::lower_bound(m_limits.begin(), m_limits.end(), size) - m_limits.begin();
+}
+
+void c_packet_stats::see_size(size_t size) {
+	c_thread_data & data = m_threads.local();
+	add(data.m_counts[bucket_of(size)], 1);
+	add(data.m_bytes, size);
+	if (size < data.m_min.load(std::memory_order_relaxed)) data.m_min.store(size, std::memory_order_relaxed);
+	if (size > data.m_max.load(std::memory_order_relaxed)) data.m_max.store(size, std::memory_order_relaxed);
+
+	const uint64_t window = m_window.load(std::memory_order_relaxed);
+	if (data.m_window.load(std::memory_order_relaxed) != window) { // first packet of this thread in new window
+		data.m_window_min.store(size, std::memory_order_relaxed);
+		data.m_window_max.store(size, std::memory_order_relaxed);
+		data.m_window.store(window, std::memory_order_release); // publish after min and max are valid
+		return;
+	}
+	if (size < data.m_window_min.load(std::memory_order_relaxed)) data.m_window_min.store(size, std::memory_order_relaxed);
+	if (size > data.m_window_max.load(std::memory_order_relaxed)) data.m_window_max.store(size, std::memory_order_relaxed);
+}
+
+c_packet_stats::c_totals c_packet_stats::get_totals() const {
+	c_totals totals{ std::vector<uint64_t>(m_limits.size(), 0), 0, 0 };
+	m_threads.for_each([&](const c_thread_data & data) {
+		for (size_t i = 0; i < m_limits.size(); ++i) {
+			const uint64_t count = data.m_counts[i].load(std::memory_order_relaxed);
+			totals.m_counts[i] += count;
+			totals.m_count += count;
+		}
+		totals.m_bytes += data.m_bytes.load(std::memory_order_relaxed);
+	});
+	return totals;
+}
+
+void c_packet_stats::print_bucket_name(std::ostream &out, size_t bucket) const {
+	const size_t low = (bucket == 0) ? 0 : m_limits.at(bucket - 1) + 1;
+	out << low << "..";
+	if (m_limits.at(bucket) == SIZE_MAX) out << "inf";
+	else out << m_limits.at(bucket);
+}
+
+void c_packet_stats::print_window(std::ostream &out) {
+	const uint64_t window = m_window.load(std::memory_order_relaxed);
+	uint64_t min = UINT64_MAX, max = 0;
+	m_threads.for_each([&](const c_thread_data & data) {
+		if (data.m_window.load(std::memory_order_acquire) != window) return; // no packets from this thread in this window
+		min = std::min(min, data.m_window_min.load(std::memory_order_relaxed));
+		max = std::max(max, data.m_window_max.load(std::memory_order_relaxed));
+	});
+	m_window.store(window + 1, std::memory_order_relaxed); // the readers start new min and max
+
+	const c_totals totals = get_totals();
+	const uint64_t count = totals.m_count - m_last_window.m_count;
+	const uint64_t bytes = totals.m_bytes - m_last_window.m_bytes;
+	size_t top_bucket = 0;
+	uint64_t top_count = 0;
+	for (size_t i = 0; i < m_limits.size(); ++i) {
+		const uint64_t bucket_count = totals.m_counts[i] - m_last_window.m_counts[i];
+		if (bucket_count > top_count) { top_count = bucket_count; top_bucket = i; }
+	}
+	m_last_window = totals;
+
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << "Sizes window: " << count << " pck";
+	if (count) {
+		out << std::fixed << std::setprecision(1) << " min=" << min << " avg=" << static_cast<double>(bytes) / count
+			<< " max=" << max << " most in ";
+		print_bucket_name(out, top_bucket);
+		out << " (" << 100. * top_count / count << "%)";
+	}
+	out << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
+
+void c_packet_stats::print(std::ostream &out) const {
+	const c_totals totals = get_totals();
+	uint64_t min = UINT64_MAX, max = 0;
+	m_threads.for_each([&](const c_thread_data & data) {
+		min = std::min(min, data.m_min.load(std::memory_order_relaxed));
+		max = std::max(max, data.m_max.load(std::memory_order_relaxed));
+	});
+
+	const auto flags = out.flags();
+	const auto precision = out.precision();
+	out << "Sizes all: " << totals.m_count << " pck";
+	if (totals.m_count) {
+		out << std::fixed << std::setprecision(1) << " min=" << min
+			<< " avg=" << static_cast<double>(totals.m_bytes) / totals.m_count << " max=" << max;
+	}
+	out << std::endl;
+	for (size_t i = 0; i < m_limits.size(); ++i) {
+		if (totals.m_counts[i] == 0) continue;
+		out << "  ";
+		print_bucket_name(out, i);
+		out << ": " << totals.m_counts[i] << " pck " << 100. * totals.m_counts[i] / totals.m_count << "%" << std::endl;
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
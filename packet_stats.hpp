@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "thread_slots.hpp"
+
+/// Distribution of sizes of packets read (the IP packet, so a GSO super-packet counts as one big packet).
+/// Buckets end at powers of two 64..64Ki and at given MTU sizes, so e.g. full 1500 MTU packets have own bucket.
+/// Readers add into own per-thread counters; one reporter thread prints windows.
+class c_packet_stats final {
+	public:
+		/// mtus - sizes that end a bucket besides the powers of two (e.g. the device MTU, 1280, 1500, 9000)
+		explicit c_packet_stats(const std::vector<size_t> &mtus);
+
+		void see_size(size_t size); ///< count one packet, from any thread
+
+		/// prints count, min/avg/max and the most common bucket since previous print_window(), and starts new window.
+		/// Call only from one thread (the reporter)
+		void print_window(std::ostream &out);
+		void print(std::ostream &out) const; ///< prints min/avg/max and all non-empty buckets of all packets
+
+		struct c_totals { ///< sum of all threads
+			std::vector<uint64_t> m_counts; ///< of each bucket
+			uint64_t m_count, m_bytes;
+		};
+		c_totals get_totals() const;
+
+	private:
+		static constexpr size_t max_buckets = 32;
+
+		struct c_thread_data {
+			std::atomic<uint64_t> m_counts[max_buckets];
+			std::atomic<uint64_t> m_bytes; ///< sum of all sizes
+			std::atomic<uint64_t> m_min, m_max; ///< of all packets
+			std::atomic<uint64_t> m_window; ///< to which window belong m_window_min and m_window_max
+			std::atomic<uint64_t> m_window_min, m_window_max;
+			c_thread_data();
+		};
+
+		std::vector<size_t> m_limits; ///< m_limits[i] is the biggest size in bucket i; last one is SIZE_MAX
+		c_thread_slots<c_thread_data> m_threads;
+		std::atomic<uint64_t> m_window; ///< number of current window, the reporter increments it
+
+		c_totals m_last_window; ///< the totals at previous print_window()
+
+		size_t bucket_of(size_t size) const;
+		void print_bucket_name(std::ostream &out, size_t bucket) const; ///< e.g. 1281..1500
+};
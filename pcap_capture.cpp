@@ -0,0 +1,182 @@
+#include "pcap_capture.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t pcap_magic_ns = 0xA1B23C4D; ///< pcap with nanosecond timestamps
+const uint32_t linktype_raw = 101; ///< the packet starts with IPv4 or IPv6 header
+const size_t pcap_header_size = 24;
+const size_t record_header_size = 16;
+
+uint64_t get_realtime_ns() {
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000 * 1000 * 1000 + now.tv_nsec;
+}
+
+size_t round_down_power_of_2(size_t value) {
+	size_t result = 1;
+	while (result * 2 <= value) result *= 2;
+	return result;
+}
+
+} // namespace
+
+constexpr size_t c_pcap_capture::headers_snaplen;
+constexpr size_t c_pcap_capture::max_snaplen;
+constexpr size_t c_pcap_capture::default_ring_bytes;
+
+c_pcap_capture::c_pcap_capture(const std::string &path, size_t file_size, size_t snaplen, size_t ring_bytes)
+	: m_path(path), m_file_size(file_size), m_snaplen(snaplen ? std::min(snaplen, max_snaplen) : headers_snaplen),
+	m_ring_mask(round_down_power_of_2(std::max<size_t>(ring_bytes / m_snaplen, 2)) - 1),
+	m_slots(m_ring_mask + 1), m_data(new unsigned char[(m_ring_mask + 1) * m_snaplen]),
+	m_enqueue_position(0), m_count_dropped(0),
+	m_dequeue_position(0), m_fd(-1), m_map(nullptr), m_file_used(0), m_count_captured(0), m_count_files(0),
+	m_stop(false)
+{
+	if (m_file_size < pcap_header_size + record_header_size + m_snaplen)
+		throw std::invalid_argument("capture file size is too small for the snaplen");
+	for (size_t i = 0; i < m_slots.size(); i++) m_slots.at(i).m_sequence.store(i, std::memory_order_relaxed);
+	open_file();
+	m_writer_thread = std::thread([this] { writer_loop(); });
+}
+
+c_pcap_capture::~c_pcap_capture() {
+	stop();
+}
+
+void c_pcap_capture::stop() {
+	m_stop = true;
+	if (m_writer_thread.joinable()) m_writer_thread.join();
+	close_file();
+}
+
+void c_pcap_capture::see_packet(const unsigned char *ip_packet, size_t size) {
+	// bounded MPMC ring of D. Vyukov: claim a position whose slot is free, fill it, then publish it by its sequence
+	uint64_t position = m_enqueue_position.load(std::memory_order_relaxed);
+	c_slot *slot;
+	for (;;) {
+		slot = &m_slots[position & m_ring_mask];
+		const uint64_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+		const int64_t difference = static_cast<int64_t>(sequence - position);
+		if (difference == 0) {
+			if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+		} else if (difference < 0) { // the writer did not take this slot yet, ring is full
+			m_count_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else position = m_enqueue_position.load(std::memory_order_relaxed);
+	}
+	const size_t captured_size = std::min(size, m_snaplen);
+	std::memcpy(&m_data[(position & m_ring_mask) * m_snaplen], ip_packet, captured_size);
+	slot->m_captured_size = static_cast<uint32_t>(captured_size);
+	slot->m_size = static_cast<uint32_t>(size);
+	slot->m_time_ns = get_realtime_ns();
+	slot->m_sequence.store(position + 1, std::memory_order_release);
+}
+
+size_t c_pcap_capture::get_count_captured() const {
+	return m_count_captured.load(std::memory_order_relaxed);
+}
+
+size_t c_pcap_capture::get_count_dropped() const {
+	return m_count_dropped.load(std::memory_order_relaxed);
+}
+
+void c_pcap_capture::print(std::ostream &out) const {
+	out << "Capture " << m_path << ": " << get_count_captured() << " pck captured, " << get_count_dropped()
+		<< " dropped (ring full), snaplen " << m_snaplen << ", ring " << (m_ring_mask + 1) << " pck, files "
+		<< m_count_files.load() << std::endl;
+}
+
+void c_pcap_capture::writer_loop() {
+	for (;;) {
+		if (write_one()) continue;
+		if (m_stop.load()) { // readers are done, write what they left in the ring
+			while (write_one()) { }
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(200)); // ring empty; it holds ring_size packets meanwhile
+	}
+}
+
+bool c_pcap_capture::write_one() {
+	c_slot &slot = m_slots[m_dequeue_position & m_ring_mask];
+	if (slot.m_sequence.load(std::memory_order_acquire) != m_dequeue_position + 1) return false;
+
+	const size_t record_size = record_header_size + slot.m_captured_size;
+	if ((m_fd >= 0) && (m_file_used + record_size > m_file_size)) { // full: keep it as PATH.1, start a new PATH
+		close_file();
+		const std::string previous = m_path + ".1";
+		try {
+			if (rename(m_path.c_str(), previous.c_str()) != 0)
+				throw std::runtime_error("can not rename capture file to " + previous + ": " + strerror(errno));
+			open_file();
+		} catch (const std::exception &error) { // the test goes on, without capture
+			std::cerr << "capture stopped: " << error.what() << std::endl;
+		}
+	}
+	if (m_fd < 0) { // capture stopped, just free the slot
+		m_count_dropped.fetch_add(1, std::memory_order_relaxed);
+		slot.m_sequence.store(m_dequeue_position + m_ring_mask + 1, std::memory_order_release);
+		++m_dequeue_position;
+		return true;
+	}
+	const uint32_t record_header[4] = {
+		static_cast<uint32_t>(slot.m_time_ns / (1000 * 1000 * 1000)),
+		static_cast<uint32_t>(slot.m_time_ns % (1000 * 1000 * 1000)),
+		slot.m_captured_size,
+		slot.m_size,
+	};
+	unsigned char *record = m_map + m_file_used;
+	std::memcpy(record, record_header, sizeof(record_header));
+	std::memcpy(record + record_header_size, &m_data[(m_dequeue_position & m_ring_mask) * m_snaplen], slot.m_captured_size);
+	m_file_used += record_size;
+	m_count_captured.fetch_add(1, std::memory_order_relaxed);
+
+	slot.m_sequence.store(m_dequeue_position + m_ring_mask + 1, std::memory_order_release); // free for the next round
+	++m_dequeue_position;
+	return true;
+}
+
+void c_pcap_capture::open_file() {
+	m_fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (m_fd < 0) throw std::runtime_error("can not open capture file " + m_path + ": " + strerror(errno));
+	if (ftruncate(m_fd, static_cast<off_t>(m_file_size)) != 0) {
+		close(m_fd);
+		m_fd = -1;
+		throw std::runtime_error("can not size capture file " + m_path + ": " + strerror(errno));
+	}
+	void *map = mmap(nullptr, m_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (map == MAP_FAILED) {
+		close(m_fd);
+		m_fd = -1;
+		throw std::runtime_error("can not map capture file " + m_path + ": " + strerror(errno));
+	}
+	m_map = static_cast<unsigned char *>(map);
+	const uint32_t magic = pcap_magic_ns; // all in host order, the reader finds it out from the magic
+	const uint16_t version[2] = { 2, 4 };
+	const uint32_t rest[4] = { 0, 0, static_cast<uint32_t>(m_snaplen), linktype_raw }; // zone, sigfigs, snaplen, link type
+	std::memcpy(m_map, &magic, sizeof(magic));
+	std::memcpy(m_map + 4, version, sizeof(version));
+	std::memcpy(m_map + 8, rest, sizeof(rest));
+	m_file_used = pcap_header_size;
+	m_count_files.fetch_add(1, std::memory_order_relaxed);
+}
+
+void c_pcap_capture::close_file() {
+	if (m_fd < 0) return;
+	munmap(m_map, m_file_size);
+	m_map = nullptr;
+	if (ftruncate(m_fd, static_cast<off_t>(m_file_used)) != 0) std::cerr << "can not cut capture file " << m_path << '\n';
+	close(m_fd);
+	m_fd = -1;
+}
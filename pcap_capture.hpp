@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Records the packets read into a pcap file (nanosecond timestamps, raw IP link type), without slowing the readers:
+/// a reader only copies the first snaplen bytes of the packet into a slot of a bounded lock-free ring (or drops it,
+/// counted, if the ring is full) and goes on. A background thread takes the slots in order and appends the records
+/// into a file that is pre-sized to file_size and memory-mapped, so writing a record is a memcpy and no syscall.
+/// When the file is full it is cut to the used size and renamed to PATH.1 (replacing the older one), and a new PATH
+/// is started; so at most the last 2 * file_size of traffic is kept on disk.
+class c_pcap_capture final {
+	public:
+		static constexpr size_t headers_snaplen = 96; ///< snaplen 0: IP and UDP headers, and the test payload header
+		static constexpr size_t max_snaplen = 65535; ///< no IP packet is longer, bigger snaplen is cut to it
+		static constexpr size_t default_ring_bytes = 8 * 1024 * 1024;
+
+		/// snaplen - bytes of each packet to keep (0 - headers only); ring_bytes - memory for the packets that wait for
+		/// the writer, the ring gets as many slots of snaplen as fit into it (a power of 2, at least 2)
+		c_pcap_capture(const std::string &path, size_t file_size, size_t snaplen, size_t ring_bytes = default_ring_bytes);
+		~c_pcap_capture(); ///< stop()
+		c_pcap_capture(const c_pcap_capture &) = delete;
+		c_pcap_capture &operator=(const c_pcap_capture &) = delete;
+
+		/// capture IP packet of this size; can be called from many threads at once, never blocks nor allocates
+		void see_packet(const unsigned char *ip_packet, size_t size);
+
+		/// writes what is in the ring, and closes the file; packets seen after it are not captured
+		void stop();
+
+		size_t get_count_captured() const; ///< packets written into the file
+		size_t get_count_dropped() const; ///< packets not captured because the ring was full (or the file failed)
+		void print(std::ostream &out) const;
+
+	private:
+		/// state of one ring slot; its data is in m_data
+		struct alignas(64) c_slot {
+			std::atomic<uint64_t> m_sequence; ///< == position: free for writing it; == position + 1: filled
+			uint32_t m_captured_size;
+			uint32_t m_size; ///< size of the whole packet
+			uint64_t m_time_ns; ///< CLOCK_REALTIME
+		};
+
+		const std::string m_path;
+		const size_t m_file_size;
+		const size_t m_snaplen;
+		const size_t m_ring_mask; ///< ring size is a power of 2
+		std::vector<c_slot> m_slots;
+		std::unique_ptr<unsigned char[]> m_data; ///< m_snaplen bytes for each slot, not zeroed (the ring can be big)
+		alignas(64) std::atomic<uint64_t> m_enqueue_position; ///< next position readers write to
+		alignas(64) std::atomic<size_t> m_count_dropped;
+
+		// used only by the writer thread (and after it ended)
+		uint64_t m_dequeue_position;
+		int m_fd; ///< of the current file, -1 if capture stopped on an error
+		unsigned char *m_map;
+		size_t m_file_used; ///< bytes written into the current file
+		std::atomic<size_t> m_count_captured;
+		std::atomic<size_t> m_count_files; ///< files started
+
+		std::atomic<bool> m_stop;
+		std::thread m_writer_thread;
+
+		void writer_loop();
+		bool write_one(); ///< moves one slot from ring to the file; false if the ring is empty
+		void open_file(); ///< creates the file, maps it, writes the pcap header
+		void close_file(); ///< unmaps it and cuts it to the used size
+};
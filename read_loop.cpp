@@ -0,0 +1,71 @@
+#include "read_loop.hpp"
+#include <new>
+
+c_read_sequence::c_read_sequence()
+	: m_next_post(0), m_completed_end(0), m_count_out_of_order(0)
+{ }
+
+uint64_t c_read_sequence::see_post() {
+	return m_next_post.fetch_add(1, std::memory_order_relaxed);
+}
+
+void c_read_sequence::see_completion(uint64_t sequence) {
+	uint64_t end = m_completed_end.load(std::memory_order_relaxed);
+	while ((sequence >= end) && !m_completed_end.compare_exchange_weak(end, sequence + 1, std::memory_order_relaxed)) { }
+	if (sequence + 1 < end) m_count_out_of_order.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t c_read_sequence::get_count_out_of_order() const {
+	return m_count_out_of_order.load(std::memory_order_relaxed);
+}
+
+/******************************************************************/
+
+constexpr size_t c_read_loop::slot_size;
+
+c_read_loop::c_handler_slot::c_handler_slot()
+	: m_in_use(false), m_count_heap(0)
+{ }
+
+void *c_read_loop::c_handler_slot::allocate(size_t size) {
+	if (!m_in_use && (size <= sizeof(m_memory))) {
+		m_in_use = true;
+		return m_memory;
+	}
+	m_count_heap.fetch_add(1, std::memory_order_relaxed);
+	return ::operator new(size);
+}
+
+void c_read_loop::c_handler_slot::deallocate(void *pointer) {
+	if (pointer == m_memory) m_in_use = false;
+	else ::operator delete(pointer);
+}
+
+/******************************************************************/
+
+c_read_loop::c_read_loop(boost::asio::posix::stream_descriptor &descriptor, unsigned char *buffer, size_t buffer_size,
+	t_packet_handler handler, c_read_sequence *sequence)
+	: m_descriptor(descriptor), m_buffer(buffer), m_buffer_size(buffer_size), m_handler(handler), m_sequence(sequence),
+	m_posted(0)
+{ }
+
+void c_read_loop::start() {
+	read();
+}
+
+size_t c_read_loop::get_count_heap_allocations() const {
+	return m_slot.m_count_heap.load(std::memory_order_relaxed);
+}
+
+void c_read_loop::read() {
+	if (m_sequence) m_posted = m_sequence->see_post();
+	m_descriptor.async_read_some(boost::asio::buffer(m_buffer, m_buffer_size), c_read_handler(*this));
+}
+
+void c_read_loop::c_read_handler::operator()(const boost::system::error_code &error, size_t bytes_transferred) const {
+	if (error) return;
+	if (m_loop->m_sequence) m_loop->m_sequence->see_completion(m_loop->m_posted);
+	// asio already gave the slot back (it frees the operation before calling us), so the next read can take it
+	m_loop->m_handler(m_loop->m_buffer, bytes_transferred);
+	m_loop->read();
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <functional>
+
+/// Order of the reads of one descriptor, shared by all c_read_loop reading it: asio performs the pending reads of a
+/// descriptor in the order they were posted, so the number taken when posting is the order of the data read. Their
+/// completions then run on any thread of the io_service, and can run out of this order (reads posted at the same
+/// moment by two threads may also swap, and are counted too).
+class c_read_sequence final {
+	public:
+		c_read_sequence();
+		uint64_t see_post(); ///< number of the read being posted
+		void see_completion(uint64_t sequence); ///< completion of read that got this number from see_post() started
+		size_t get_count_out_of_order() const; ///< completions that started after the completion of a later posted read
+
+	private:
+		std::atomic<uint64_t> m_next_post;
+		std::atomic<uint64_t> m_completed_end; ///< 1 + highest number whose completion started
+		std::atomic<size_t> m_count_out_of_order;
+};
+
+/// Keeps one async_read_some pending on a stream_descriptor, and re-arms it from its completion, with no heap
+/// allocation per read: the completion handler is a small object pointing back to this loop (not a std::function
+/// copied for each read), and the memory asio needs for the pending operation comes, through the associated allocator
+/// of the handler, from one slot owned by this loop that is recycled for every read. Only if asio asks for more than
+/// fits into the slot (or for a second block while the slot is taken) it falls back to the heap, and counts it.
+/// More loops may read the same descriptor, each with own buffer, to keep many reads in flight on it; then the threads
+/// of the io_service process their completions at the same time, instead of one after another.
+class c_read_loop final {
+	public:
+		using t_packet_handler = std::function<void(const unsigned char *data, size_t size)>;
+
+		/// buffer - of buffer_size bytes, not owned, used for every read of this loop;
+		/// handler - called from the completion, before the read is posted again;
+		/// sequence - if not null, the reads are numbered in it (not owned, shared by the loops of the descriptor)
+		c_read_loop(boost::asio::posix::stream_descriptor &descriptor, unsigned char *buffer, size_t buffer_size,
+			t_packet_handler handler, c_read_sequence *sequence = nullptr);
+		c_read_loop(const c_read_loop &) = delete;
+		c_read_loop &operator=(const c_read_loop &) = delete;
+
+		void start(); ///< post the first read; then it runs until the descriptor is closed or its io_service stopped
+
+		size_t get_count_heap_allocations() const; ///< handler memory that did not fit into the slot, 0 in steady state
+
+	private:
+		static constexpr size_t slot_size = 512; ///< descriptor_read_op with our handler is much smaller
+
+		/// memory for the one pending operation
+		struct c_handler_slot {
+			c_handler_slot();
+			alignas(std::max_align_t) unsigned char m_memory[slot_size];
+			bool m_in_use;
+			std::atomic<size_t> m_count_heap; ///< allocations that went to the heap
+			void *allocate(size_t size);
+			void deallocate(void *pointer);
+		};
+
+		/// the associated allocator of c_read_handler, asio rebinds it to the type of its operation
+		template <typename T>
+		class c_slot_allocator {
+			public:
+				using value_type = T;
+				explicit c_slot_allocator(c_handler_slot &slot) noexcept : m_slot(&slot) { }
+				template <typename U> c_slot_allocator(const c_slot_allocator<U> &other) noexcept : m_slot(other.m_slot) { }
+				T *allocate(size_t n) { return static_cast<T *>(m_slot->allocate(sizeof(T) * n)); }
+				void deallocate(T *pointer, size_t) { m_slot->deallocate(pointer); }
+				template <typename U> bool operator==(const c_slot_allocator<U> &other) const noexcept { return m_slot == other.m_slot; }
+				template <typename U> bool operator!=(const c_slot_allocator<U> &other) const noexcept { return m_slot != other.m_slot; }
+			private:
+				template <typename U> friend class c_slot_allocator;
+				c_handler_slot *m_slot;
+		};
+
+		/// completion handler of each read, cheap to copy
+		class c_read_handler {
+			public:
+				using allocator_type = c_slot_allocator<char>;
+				explicit c_read_handler(c_read_loop &loop) : m_loop(&loop) { }
+				allocator_type get_allocator() const noexcept { return allocator_type(m_loop->m_slot); }
+				void operator()(const boost::system::error_code &error, size_t bytes_transferred) const;
+			private:
+				c_read_loop *m_loop;
+		};
+
+		boost::asio::posix::stream_descriptor &m_descriptor;
+		unsigned char * const m_buffer;
+		const size_t m_buffer_size;
+		t_packet_handler m_handler;
+		c_handler_slot m_slot;
+		c_read_sequence * const m_sequence;
+		uint64_t m_posted; ///< number of the pending read in m_sequence
+
+		void read(); ///< post one read
+};
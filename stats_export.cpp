@@ -0,0 +1,114 @@
+#include "stats_export.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+c_stats_exporter::c_stats_exporter()
+	: m_csv_header_written(false), m_listen_fd(-1), m_stop(false)
+{ }
+
+c_stats_exporter::~c_stats_exporter() {
+	m_stop = true;
+	if (m_server_thread.joinable()) m_server_thread.join();
+	if (m_listen_fd >= 0) close(m_listen_fd);
+}
+
+void c_stats_exporter::open_file(const std::string &path, const std::string &format) {
+	if ((format != "json") && (format != "csv")) throw std::invalid_argument("unknown stats format " + format);
+	m_file.open(path, std::ios::out | std::ios::trunc);
+	if (!m_file) throw std::runtime_error("can not open stats file " + path);
+	m_format = format;
+}
+
+void c_stats_exporter::serve_prometheus(uint16_t port) {
+	m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (m_listen_fd < 0) throw std::runtime_error(std::string("stats socket: ") + strerror(errno));
+	const int on = 1;
+	setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	sockaddr_in address;
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local only, there is no authentication
+	address.sin_port = htons(port);
+	if ((bind(m_listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) || (listen(m_listen_fd, 8) < 0))
+		throw std::runtime_error(std::string("stats listen: ") + strerror(errno));
+	m_server_thread = std::thread([this] { serve_loop(); });
+}
+
+std::string c_stats_exporter::format_number(double value) {
+	std::ostringstream out;
+	if ((value == std::floor(value)) && (std::fabs(value) < 1e15)) out << static_cast<int64_t>(value);
+	else out << std::setprecision(9) << value;
+	return out.str();
+}
+
+void c_stats_exporter::export_snapshot(const t_metrics &metrics) {
+	if (m_file.is_open()) {
+		if (m_format == "json") {
+			m_file << '{';
+			for (size_t i = 0; i < metrics.size(); ++i)
+				m_file << (i ? "," : "") << '"' << metrics[i].name << "\":" << format_number(metrics[i].value);
+			m_file << "}\n";
+		} else {
+			if (!m_csv_header_written) {
+				for (size_t i = 0; i < metrics.size(); ++i) m_file << (i ? "," : "") << metrics[i].name;
+				m_file << '\n';
+				m_csv_header_written = true;
+			}
+			for (size_t i = 0; i < metrics.size(); ++i) m_file << (i ? "," : "") << format_number(metrics[i].value);
+			m_file << '\n';
+		}
+		m_file.flush(); // a soak run can be stopped any time, the lines so far should be usable
+	}
+
+	if (m_listen_fd >= 0) {
+		std::ostringstream text;
+		for (const auto & metric : metrics) {
+			const std::string name = "tuntest_" + metric.name;
+			text << "# HELP " << name << ' ' << metric.help << '\n';
+			text << "# TYPE " << name << ' ' << (metric.is_counter ? "counter" : "gauge") << '\n';
+			text << name << ' ' << format_number(metric.value) << '\n';
+		}
+		std::lock_guard<std::mutex> lg(m_prometheus_mutex);
+		m_prometheus_text = text.str();
+	}
+}
+
+void c_stats_exporter::serve_loop() {
+	pollfd poll_fd;
+	poll_fd.fd = m_listen_fd;
+	poll_fd.events = POLLIN;
+	while (!m_stop) {
+		if (poll(&poll_fd, 1, 100) <= 0) continue; // timeout to notice m_stop
+		const int client = accept(m_listen_fd, nullptr, nullptr);
+		if (client < 0) continue;
+		const timeval timeout{ 1, 0 }; // a slow client must not stop the server for long
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		char request[2048];
+		ssize_t got = recv(client, request, sizeof(request), 0); // the request itself does not matter, any path gets the metrics
+		(void)got;
+		std::string body;
+		{
+			std::lock_guard<std::mutex> lg(m_prometheus_mutex);
+			body = m_prometheus_text;
+		}
+		const std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+			+ std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+		size_t sent = 0;
+		while (sent < response.size()) {
+			const ssize_t now = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if (now <= 0) break;
+			sent += now;
+		}
+		close(client);
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// One value of a stats snapshot. Names are in Prometheus style (lower case, _total for counters).
+struct c_metric {
+	std::string name;
+	double value;
+	bool is_counter; ///< only grows (else it is a gauge)
+	std::string help; ///< one line description
+};
+using t_metrics = std::vector<c_metric>;
+
+/// Writes stats snapshots made by the reporter thread in machine readable form: JSON lines or CSV into a file,
+/// and/or Prometheus text format served over HTTP on a local port (by own thread, from the last snapshot, so
+/// a scrape never touches the counters). Readers of packets are not involved at all.
+class c_stats_exporter final {
+	public:
+		c_stats_exporter();
+		~c_stats_exporter();
+		c_stats_exporter(const c_stats_exporter &) = delete;
+		c_stats_exporter &operator=(const c_stats_exporter &) = delete;
+
+		/// format - "json" (one object per line) or "csv" (header line, then one line per snapshot)
+		void open_file(const std::string &path, const std::string &format);
+		void serve_prometheus(uint16_t port); ///< listen on 127.0.0.1:port, answer each request with the last snapshot
+
+		/// write one snapshot; the set of metrics should be the same each time (for CSV columns)
+		void export_snapshot(const t_metrics &metrics);
+
+	private:
+		std::ofstream m_file;
+		std::string m_format;
+		bool m_csv_header_written;
+
+		std::mutex m_prometheus_mutex; ///< guards m_prometheus_text
+		std::string m_prometheus_text; ///< the last snapshot, rendered
+		int m_listen_fd;
+		std::thread m_server_thread;
+		std::atomic<bool> m_stop;
+
+		void serve_loop();
+		static std::string format_number(double value); ///< integers without exponent or decimals
+};
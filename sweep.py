@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Scaling sweep: runs tun_test once for each point of a matrix of thread counts, MTUs, read buffer sizes,
+engines and device counts, and prints a table of Mpps, Gbit/s and loss of each point (and writes it as CSV with --csv).
+Options it does not know are passed to every tun_test run, e.g.:
+  ./sweep.py --bin build/tun_test --threads 1,2,4,8 --mtu 1500,9000 --engine asio,uring --csv knee.csv --generate 4
+  ./sweep.py --threads 1,2 --device loopback --queues 2
+  ./sweep.py --threads 4 --devices 1,16,256 --generate 4 --cpus 0-3 # reactor with more and more fds
+The numbers come from the last snapshot of tun_test --stats-file (see the --stats-* options of tun_test)."""
+
+import argparse
+import csv
+import itertools
+import os
+import subprocess
+import sys
+import tempfile
+
+COLUMNS = ['threads', 'mtu', 'buf_size', 'engine', 'devices', 'seconds', 'packets', 'mpps', 'gbits', 'loss_percent', 'status']
+
+
+def parse_list(text, kind=int):
+	return [kind(item) for item in text.split(',') if item]
+
+
+def run_point(options, extra, threads, mtu, buf_size, engine, devices):
+	"""one run of tun_test, returns the row for the table"""
+	row = {'threads': threads, 'mtu': mtu, 'buf_size': buf_size, 'engine': engine, 'devices': devices}
+	stats_fd, stats_path = tempfile.mkstemp(prefix='tun_test_sweep_', suffix='.csv')
+	os.close(stats_fd)
+	command = [options.bin, '-j', str(threads), '--mtu', str(mtu), '--buf-size', str(buf_size), '--engine', engine,
+		'--devices', str(devices), '--packets', str(options.packets), '--stats-file', stats_path, '--stats-format', 'csv',
+		'--stats-interval', str(3600 * 1000)] + extra # one snapshot at start, and one at the end
+	if options.verbose:
+		print(' '.join(command), file=sys.stderr)
+	try:
+		subprocess.run(command, stdout=(None if options.verbose else subprocess.DEVNULL), timeout=options.timeout, check=True)
+		with open(stats_path) as stats:
+			snapshots = list(csv.DictReader(stats))
+	except subprocess.TimeoutExpired:
+		row['status'] = 'timeout'
+		return row
+	except subprocess.CalledProcessError as error:
+		row['status'] = 'exit %d' % error.returncode
+		return row
+	finally:
+		os.unlink(stats_path)
+	if not snapshots:
+		row['status'] = 'no stats'
+		return row
+
+	last = snapshots[-1]
+	seconds = float(last['run_seconds'])
+	packets = int(last['segments_total']) # on the wire, so GSO super-packets count as their segments
+	expected = int(last['check_max_index']) + 1
+	row['seconds'] = '%.3f' % seconds
+	row['packets'] = packets
+	row['mpps'] = '%.3f' % (packets / seconds / 1e6) if seconds > 0 else ''
+	row['gbits'] = '%.3f' % (float(last['bytes_total']) * 8 / seconds / 1e9) if seconds > 0 else ''
+	row['loss_percent'] = '%.3f' % (100.0 * int(last['check_missing']) / expected) if int(last['check_unique_total']) else ''
+	row['status'] = 'ok'
+	return row
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter,
+		allow_abbrev=False) # so that --device of tun_test is not taken for --devices
+	parser.add_argument('--bin', default='./tun_test', help='the tun_test binary')
+	parser.add_argument('--threads', default='1', help='comma separated -j values')
+	parser.add_argument('--mtu', default='65500', help='comma separated --mtu values')
+	parser.add_argument('--buf-size', default='65535', help='comma separated --buf-size values')
+	parser.add_argument('--engine', default='asio', help='comma separated --engine values (asio, uring, poll)')
+	parser.add_argument('--devices', default='1', help='comma separated --devices values (TUNs on one shared thread pool)')
+	parser.add_argument('--packets', type=int, default=1000 * 1000, help='--packets of each run')
+	parser.add_argument('--timeout', type=float, default=120, help='seconds before a run is killed')
+	parser.add_argument('--csv', help='write the table also into this CSV file')
+	parser.add_argument('--verbose', action='store_true', help='show the commands and the output of tun_test')
+	options, extra = parser.parse_known_args()
+	if extra and extra[0] == '--':
+		extra = extra[1:]
+
+	points = itertools.product(parse_list(options.threads), parse_list(options.mtu), parse_list(options.buf_size),
+		parse_list(options.engine, str), parse_list(options.devices))
+	widths = [max(len(column), 8) for column in COLUMNS]
+	print('  '.join(column.rjust(width) for column, width in zip(COLUMNS, widths)), flush=True)
+	rows = []
+	for threads, mtu, buf_size, engine, devices in points:
+		row = run_point(options, extra, threads, mtu, buf_size, engine, devices)
+		rows.append(row)
+		print('  '.join(str(row.get(column, '')).rjust(width) for column, width in zip(COLUMNS, widths)), flush=True)
+
+	if options.csv:
+		with open(options.csv, 'w', newline='') as out:
+			writer = csv.DictWriter(out, fieldnames=COLUMNS)
+			writer.writeheader()
+			writer.writerows(rows)
+	return 0 if all(row['status'] == 'ok' for row in rows) else 1
+
+
+if __name__ == '__main__':
+	sys.exit(main())
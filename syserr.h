@@ -11,6 +11,9 @@ typedef enum {
     e_netplatform_err_open_socket=-20,
 	e_netplatform_err_open_fd=-25,
 	e_netplatform_err_ioctl=-30,
+	e_netplatform_err_netlink_send=-40,
+	e_netplatform_err_netlink_recv=-41,
+	e_netplatform_err_netlink_answer=-42,
     e_netplatform_err_invalid_addr_family=-100,
     e_netplatform_err_not_impl_addr_family=-101,
     e_netplatform_err_socketForIfName_open=-220,
@@ -0,0 +1,93 @@
+#include "thread_placement.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+std::vector<int> parse_cpu_list(const std::string &text) {
+	std::vector<int> cpus;
+	std::istringstream in(text);
+	std::string range;
+	while (std::getline(in, range, ',')) {
+		if (range.empty()) continue;
+		const size_t dash = range.find('-');
+		try {
+			const int first = std::stoi(range.substr(0, dash));
+			const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+			if ((first < 0) || (last < first) || (last >= CPU_SETSIZE)) throw std::invalid_argument("bad range");
+			for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+		} catch (const std::logic_error &) { // stoi throws invalid_argument or out_of_range
+			throw std::invalid_argument("bad CPU list " + text);
+		}
+	}
+	return cpus;
+}
+
+void pin_this_thread(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err != 0) throw std::runtime_error("can not pin thread to CPU " + std::to_string(cpu) + ": " + strerror(err));
+}
+
+int get_numa_node_of_cpu(int cpu) {
+#ifdef HAVE_LIBNUMA
+	if (numa_available() < 0) return -1;
+	return numa_node_of_cpu(cpu);
+#else
+	(void)cpu;
+	return -1;
+#endif
+}
+
+c_thread_placement::c_thread_placement()
+	: m_fifo_priority(0)
+{ }
+
+c_thread_placement::c_thread_placement(const std::vector<int> &cpus, int fifo_priority)
+	: m_cpus(cpus), m_fifo_priority(fifo_priority)
+{
+	if ((fifo_priority < 0) || (fifo_priority > 99)) throw std::invalid_argument("SCHED_FIFO priority must be 1..99");
+}
+
+void c_thread_placement::apply(size_t thread_nr) const {
+	std::ostringstream info; // one write, threads start at once
+	info << "thread " << thread_nr;
+	if (is_pinned()) {
+		const int cpu = get_cpu(thread_nr);
+		pin_this_thread(cpu);
+		info << " on CPU " << cpu << " (NUMA node " << get_numa_node(thread_nr) << ")";
+	}
+	if (m_fifo_priority > 0) {
+		sched_param param;
+		std::memset(&param, 0, sizeof(param));
+		param.sched_priority = m_fifo_priority;
+		const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err == 0) info << " SCHED_FIFO " << m_fifo_priority;
+		else info << " warning: can not set SCHED_FIFO: " << strerror(err);
+	}
+	info << '\n';
+	if (is_pinned() || (m_fifo_priority > 0)) std::cout << info.str();
+}
+
+bool c_thread_placement::is_pinned() const {
+	return !m_cpus.empty();
+}
+
+int c_thread_placement::get_cpu(size_t thread_nr) const {
+	if (m_cpus.empty()) return -1;
+	return m_cpus.at(thread_nr % m_cpus.size());
+}
+
+int c_thread_placement::get_numa_node(size_t thread_nr) const {
+	if (m_cpus.empty()) return -1;
+	return get_numa_node_of_cpu(get_cpu(thread_nr));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// CPU numbers from a list like "0-3,8,10-11" (as in taskset -c, or /sys/devices/system/node/node0/cpulist)
+std::vector<int> parse_cpu_list(const std::string &text);
+
+void pin_this_thread(int cpu); ///< run the calling thread only on this CPU; throws std::runtime_error
+int get_numa_node_of_cpu(int cpu); ///< NUMA node of the CPU, -1 if not known (no NUMA support, or bad CPU)
+
+/// Where the I/O threads run: thread nr i is pinned to CPU i of the list (wrapping around), and optionally
+/// gets real-time SCHED_FIFO priority. Default constructed one leaves the threads as they are.
+class c_thread_placement final {
+	public:
+		c_thread_placement(); ///< no pinning, normal scheduling
+		/// cpus - CPU for each thread nr (empty: not pinned); fifo_priority - 1..99 for SCHED_FIFO, 0 for normal scheduling
+		c_thread_placement(const std::vector<int> &cpus, int fifo_priority);
+
+		/// call from the started thread that has number thread_nr; prints what was done, only warns if scheduling can not
+		/// be set (it needs CAP_SYS_NICE), and throws if the thread can not be pinned
+		void apply(size_t thread_nr) const;
+
+		bool is_pinned() const;
+		int get_cpu(size_t thread_nr) const; ///< CPU that thread nr will run on, -1 if not pinned
+		int get_numa_node(size_t thread_nr) const; ///< NUMA node of that CPU, -1 if not pinned or not known
+
+	private:
+		std::vector<int> m_cpus;
+		int m_fifo_priority;
+};
@@ -0,0 +1,41 @@
+#include "thread_slots.hpp"
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+std::atomic<size_t> thread_slot_count(0);
+std::mutex free_slots_mutex; ///< taken only when a thread takes its number or ends, never per packet
+std::vector<size_t> free_slots; ///< numbers of the threads that ended
+
+/// the number of one thread, given back when the thread ends
+class c_thread_slot_nr final {
+	public:
+		c_thread_slot_nr() {
+			std::lock_guard<std::mutex> lg(free_slots_mutex);
+			if (free_slots.empty()) m_nr = thread_slot_count.fetch_add(1);
+			else {
+				m_nr = free_slots.back();
+				free_slots.pop_back();
+			}
+		}
+		~c_thread_slot_nr() {
+			std::lock_guard<std::mutex> lg(free_slots_mutex);
+			free_slots.push_back(m_nr);
+		}
+		size_t get() const { return m_nr; }
+
+	private:
+		size_t m_nr;
+};
+
+} // namespace
+
+size_t get_thread_slot_nr() {
+	thread_local c_thread_slot_nr nr;
+	return nr.get();
+}
+
+size_t get_thread_slot_count() {
+	return thread_slot_count.load();
+}
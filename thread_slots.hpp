@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+/// Number of the calling thread, 0,1,2... in order in which threads first called it. Never changes for a thread.
+/// When a thread ends its number is given to the next new thread, so only threads running at once need own numbers
+/// (the new thread goes on counting into the slot the old one left, and the sums stay right).
+size_t get_thread_slot_nr();
+size_t get_thread_slot_count(); ///< how many numbers were given yet (the highest + 1)
+
+/// One T for each thread, each on own cache line(s), so threads update their own data without contention,
+/// and a reporter sums all of them from time to time. T should use relaxed atomics written only by its thread.
+template <typename T>
+class c_thread_slots final {
+	public:
+		static constexpr size_t max_threads = 256;
+
+		c_thread_slots() : m_slots(max_threads) { }
+
+		T &local() { ///< the slot of the calling thread
+			const size_t nr = get_thread_slot_nr();
+			if (nr >= max_threads) throw std::runtime_error("too many threads for c_thread_slots");
+			return m_slots[nr].data;
+		}
+
+		template <typename F> void for_each(F fn) const { ///< calls fn(const T &) for slot of each thread
+			const size_t used = std::min(get_thread_slot_count(), max_threads);
+			for (size_t i = 0; i < used; ++i) fn(m_slots[i].data);
+		}
+
+	private:
+		struct alignas(64) c_padded {
+			T data;
+		};
+		std::vector<c_padded> m_slots;
+};
+template <typename T> constexpr size_t c_thread_slots<T>::max_threads;
+
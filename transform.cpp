@@ -0,0 +1,285 @@
+#include "transform.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRANSFORM_X86 1
+#include <immintrin.h>
+#endif
+
+c_transform::~c_transform() { }
+
+namespace {
+
+// the scalar kernels are the reference, keep the compiler from vectorizing them on its own
+#define SCALAR_KERNEL __attribute__((optimize("no-tree-vectorize")))
+
+inline uint32_t rotl32(uint32_t value, int bits) {
+	return (value << bits) | (value >> (32 - bits));
+}
+
+/*** ChaCha20, RFC 7539 ***/
+
+/// initial state: constants, key, block counter, nonce (word 13 is 0, the 64 bit packet nonce is in words 14, 15)
+void chacha20_init(uint32_t state[16], const uint32_t key[8], uint64_t nonce, uint32_t counter) {
+	state[0] = 0x61707865; state[1] = 0x3320646e; state[2] = 0x79622d32; state[3] = 0x6b206574; // "expand 32-byte k"
+	for (int i = 0; i < 8; ++i) state[4 + i] = key[i];
+	state[12] = counter;
+	state[13] = 0;
+	state[14] = static_cast<uint32_t>(nonce);
+	state[15] = static_cast<uint32_t>(nonce >> 32);
+}
+
+#define CHACHA_QUARTER(a, b, c, d) \
+	a += b; d ^= a; d = rotl32(d, 16); \
+	c += d; b ^= c; b = rotl32(b, 12); \
+	a += b; d ^= a; d = rotl32(d, 8); \
+	c += d; b ^= c; b = rotl32(b, 7);
+
+SCALAR_KERNEL void chacha20_block(const uint32_t state[16], unsigned char keystream[64]) {
+	uint32_t x[16];
+	for (int i = 0; i < 16; ++i) x[i] = state[i];
+	for (int round = 0; round < 10; ++round) { // 20 rounds: column and diagonal
+		CHACHA_QUARTER(x[0], x[4], x[8], x[12]);
+		CHACHA_QUARTER(x[1], x[5], x[9], x[13]);
+		CHACHA_QUARTER(x[2], x[6], x[10], x[14]);
+		CHACHA_QUARTER(x[3], x[7], x[11], x[15]);
+		CHACHA_QUARTER(x[0], x[5], x[10], x[15]);
+		CHACHA_QUARTER(x[1], x[6], x[11], x[12]);
+		CHACHA_QUARTER(x[2], x[7], x[8], x[13]);
+		CHACHA_QUARTER(x[3], x[4], x[9], x[14]);
+	}
+	for (int i = 0; i < 16; ++i) {
+		const uint32_t word = x[i] + state[i];
+		for (int byte = 0; byte < 4; ++byte) keystream[i * 4 + byte] = static_cast<unsigned char>(word >> (8 * byte));
+	}
+}
+
+/// XOR of size bytes with keystream of blocks state[12], state[12]+1, ...
+SCALAR_KERNEL void chacha20_xor_scalar(uint32_t state[16], const unsigned char *in, unsigned char *out, size_t size) {
+	unsigned char keystream[64];
+	while (size > 0) {
+		chacha20_block(state, keystream);
+		++state[12];
+		const size_t now = (size < 64) ? size : 64;
+		for (size_t i = 0; i < now; ++i) out[i] = in[i] ^ keystream[i];
+		in += now;
+		out += now;
+		size -= now;
+	}
+}
+
+#ifdef TRANSFORM_X86
+#define CHACHA_QUARTER_AVX2(a, b, c, d) \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = _mm256_or_si256(_mm256_slli_epi32(b, 12), _mm256_srli_epi32(b, 20)); \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = _mm256_or_si256(_mm256_slli_epi32(b, 7), _mm256_srli_epi32(b, 25));
+
+/// 8 blocks at once: lane i of vector x[w] is word w of block counter+i; the tail is done by the scalar code
+__attribute__((target("avx2")))
+void chacha20_xor_avx2(uint32_t state[16], const unsigned char *in, unsigned char *out, size_t size) {
+	const __m256i rot16 = _mm256_setr_epi8(2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13, 2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13);
+	const __m256i rot8 = _mm256_setr_epi8(3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14, 3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14);
+	while (size >= 8 * 64) {
+		__m256i start[16], x[16];
+		for (int i = 0; i < 16; ++i) start[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+		start[12] = _mm256_add_epi32(start[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		for (int i = 0; i < 16; ++i) x[i] = start[i];
+		for (int round = 0; round < 10; ++round) {
+			CHACHA_QUARTER_AVX2(x[0], x[4], x[8], x[12]);
+			CHACHA_QUARTER_AVX2(x[1], x[5], x[9], x[13]);
+			CHACHA_QUARTER_AVX2(x[2], x[6], x[10], x[14]);
+			CHACHA_QUARTER_AVX2(x[3], x[7], x[11], x[15]);
+			CHACHA_QUARTER_AVX2(x[0], x[5], x[10], x[15]);
+			CHACHA_QUARTER_AVX2(x[1], x[6], x[11], x[12]);
+			CHACHA_QUARTER_AVX2(x[2], x[7], x[8], x[13]);
+			CHACHA_QUARTER_AVX2(x[3], x[4], x[9], x[14]);
+		}
+		alignas(32) uint32_t words[16][8];
+		for (int i = 0; i < 16; ++i) _mm256_store_si256(reinterpret_cast<__m256i *>(words[i]), _mm256_add_epi32(x[i], start[i]));
+		alignas(32) uint32_t keystream[8][16]; // transposed to block order (x86 is little-endian, as ChaCha20 output)
+		for (int block = 0; block < 8; ++block)
+			for (int i = 0; i < 16; ++i) keystream[block][i] = words[i][block];
+		for (int i = 0; i < 16; ++i) {
+			const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i * 32));
+			const __m256i key = _mm256_load_si256(reinterpret_cast<const __m256i *>(&keystream[0][0]) + i);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i * 32), _mm256_xor_si256(data, key));
+		}
+		state[12] += 8;
+		in += 8 * 64;
+		out += 8 * 64;
+		size -= 8 * 64;
+	}
+	chacha20_xor_scalar(state, in, out, size);
+}
+#endif
+
+/*** XOR with a 64 byte keystream ***/
+
+SCALAR_KERNEL void xor_scalar(const unsigned char *keystream, const unsigned char *in, unsigned char *out, size_t size) {
+	for (size_t i = 0; i < size; ++i) out[i] = in[i] ^ keystream[i & 63];
+}
+
+#ifdef TRANSFORM_X86
+__attribute__((target("sse2")))
+void xor_sse2(const unsigned char *keystream, const unsigned char *in, unsigned char *out, size_t size) {
+	__m128i key[4];
+	for (int i = 0; i < 4; ++i) key[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keystream) + i);
+	size_t pos = 0;
+	for (; pos + 64 <= size; pos += 64) {
+		for (int i = 0; i < 4; ++i) {
+			const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos) + i);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out + pos) + i, _mm_xor_si128(data, key[i]));
+		}
+	}
+	xor_scalar(keystream, in + pos, out + pos, size - pos); // the keystream repeats every 64 bytes, so tail starts at its 0
+}
+
+__attribute__((target("avx2")))
+void xor_avx2(const unsigned char *keystream, const unsigned char *in, unsigned char *out, size_t size) {
+	const __m256i key0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keystream));
+	const __m256i key1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keystream) + 1);
+	size_t pos = 0;
+	for (; pos + 64 <= size; pos += 64) {
+		const __m256i data0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + pos));
+		const __m256i data1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + pos) + 1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + pos), _mm256_xor_si256(data0, key0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + pos) + 1, _mm256_xor_si256(data1, key1));
+	}
+	xor_scalar(keystream, in + pos, out + pos, size - pos);
+}
+#endif
+
+bool cpu_has_avx2() {
+#ifdef TRANSFORM_X86
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+bool cpu_has_sse2() {
+#ifdef TRANSFORM_X86
+	return __builtin_cpu_supports("sse2");
+#else
+	return false;
+#endif
+}
+
+/// ChaCha20 key from the key string: its bytes repeated to 32 bytes (it is a benchmark, not a key derivation)
+void make_key(const std::string &key_string, uint32_t key[8]) {
+	unsigned char bytes[32] = { 0 };
+	for (size_t i = 0; !key_string.empty() && (i < sizeof(bytes)); ++i) bytes[i] = key_string[i % key_string.size()];
+	for (int i = 0; i < 8; ++i)
+		key[i] = bytes[4 * i] | (bytes[4 * i + 1] << 8) | (bytes[4 * i + 2] << 16) | (static_cast<uint32_t>(bytes[4 * i + 3]) << 24);
+}
+
+class c_transform_xor final : public c_transform {
+	public:
+		using t_kernel = void (*)(const unsigned char *keystream, const unsigned char *in, unsigned char *out, size_t size);
+		c_transform_xor(const std::string &key_string, t_kernel kernel, const std::string &name)
+			: m_kernel(kernel), m_name(name)
+		{
+			uint32_t key[8], state[16];
+			make_key(key_string, key);
+			chacha20_init(state, key, 0, 0);
+			chacha20_block(state, m_keystream); // the fixed pattern is the first ChaCha20 block
+		}
+		void apply(const unsigned char *in, unsigned char *out, size_t size, uint64_t) const override {
+			m_kernel(m_keystream, in, out, size);
+		}
+		std::string get_name() const override { return m_name; }
+
+	private:
+		alignas(64) unsigned char m_keystream[64];
+		const t_kernel m_kernel;
+		const std::string m_name;
+};
+
+class c_transform_chacha20 final : public c_transform {
+	public:
+		using t_kernel = void (*)(uint32_t state[16], const unsigned char *in, unsigned char *out, size_t size);
+		c_transform_chacha20(const std::string &key_string, t_kernel kernel, const std::string &name)
+			: m_kernel(kernel), m_name(name)
+		{
+			make_key(key_string, m_key);
+		}
+		void apply(const unsigned char *in, unsigned char *out, size_t size, uint64_t nonce) const override {
+			uint32_t state[16];
+			chacha20_init(state, m_key, nonce, 0);
+			m_kernel(state, in, out, size);
+		}
+		std::string get_name() const override { return m_name; }
+
+	private:
+		uint32_t m_key[8];
+		const t_kernel m_kernel;
+		const std::string m_name;
+};
+
+/// the SIMD kernel must give same bytes as the scalar one, for sizes with and without tails
+void check_against_reference(const c_transform &transform, const c_transform &reference) {
+	std::vector<unsigned char> data(2000), out(2000), expected(2000);
+	for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<unsigned char>(i * 7 + 3);
+	for (size_t size : { size_t(0), size_t(1), size_t(63), size_t(64), size_t(513), size_t(1500), size_t(2000) }) {
+		transform.apply(data.data(), out.data(), size, 0x1234567890ULL + size);
+		reference.apply(data.data(), expected.data(), size, 0x1234567890ULL + size);
+		if (std::memcmp(out.data(), expected.data(), size) != 0)
+			throw std::logic_error("transform " + transform.get_name() + " differs from " + reference.get_name());
+	}
+}
+
+} // namespace
+
+std::unique_ptr<c_transform> make_transform(const std::string &name, const std::string &key) {
+	std::string kernel_name = name;
+	if (name == "xor") kernel_name = cpu_has_avx2() ? "xor-avx2" : (cpu_has_sse2() ? "xor-sse2" : "xor-scalar");
+	if (name == "chacha20") kernel_name = cpu_has_avx2() ? "chacha20-avx2" : "chacha20-scalar";
+
+	std::unique_ptr<c_transform> transform;
+	std::unique_ptr<c_transform> reference;
+	if (kernel_name == "xor-scalar") transform.reset(new c_transform_xor(key, xor_scalar, kernel_name));
+	else if (kernel_name == "chacha20-scalar") transform.reset(new c_transform_chacha20(key, chacha20_xor_scalar, kernel_name));
+#ifdef TRANSFORM_X86
+	else if ((kernel_name == "xor-sse2") && cpu_has_sse2()) {
+		transform.reset(new c_transform_xor(key, xor_sse2, kernel_name));
+		reference.reset(new c_transform_xor(key, xor_scalar, "xor-scalar"));
+	}
+	else if ((kernel_name == "xor-avx2") && cpu_has_avx2()) {
+		transform.reset(new c_transform_xor(key, xor_avx2, kernel_name));
+		reference.reset(new c_transform_xor(key, xor_scalar, "xor-scalar"));
+	}
+	else if ((kernel_name == "chacha20-avx2") && cpu_has_avx2()) {
+		transform.reset(new c_transform_chacha20(key, chacha20_xor_avx2, kernel_name));
+		reference.reset(new c_transform_chacha20(key, chacha20_xor_scalar, "chacha20-scalar"));
+	}
+#endif
+	else throw std::invalid_argument("unknown transform " + name + ", or this CPU does not have its instructions");
+
+	if (reference) check_against_reference(*transform, *reference);
+	return transform;
+}
+
+void check_cpu_for_build() {
+#ifdef TRANSFORM_X86
+	__builtin_cpu_init();
+	auto need = [](bool has, const char *what) {
+		if (!has) throw std::runtime_error(std::string("this build uses ") + what + " (-march=native on other CPU?), but this CPU lacks it");
+	};
+#ifdef __SSE4_2__
+	need(__builtin_cpu_supports("sse4.2"), "SSE4.2");
+#endif
+#ifdef __AVX__
+	need(__builtin_cpu_supports("avx"), "AVX");
+#endif
+#ifdef __AVX2__
+	need(__builtin_cpu_supports("avx2"), "AVX2");
+#endif
+#ifdef __AVX512F__
+	need(__builtin_cpu_supports("avx512f"), "AVX-512F");
+#endif
+	(void)need;
+#endif
+}
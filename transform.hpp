@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/// Per-packet transform (obfuscation or cipher) of payload bytes, done as XOR with a keystream,
+/// so the same call encodes (in generator) and decodes (in receiver). in and out can be the same buffer.
+/// nonce selects the keystream of one packet (the packet index), both sides must use the same one.
+class c_transform {
+	public:
+		virtual ~c_transform();
+		virtual void apply(const unsigned char *in, unsigned char *out, size_t size, uint64_t nonce) const = 0;
+		virtual std::string get_name() const = 0; ///< name of the kernel really used, e.g. "chacha20-avx2"
+};
+
+/// Creates transform by name:
+/// xor-scalar, xor-sse2, xor-avx2 - XOR with a fixed 64 byte keystream made from the key (obfuscation, nonce not used)
+/// chacha20-scalar, chacha20-avx2 - XOR with ChaCha20 keystream (RFC 7539), key made from the key string, nonce is the packet
+/// xor, chacha20 - the fastest kernel that this CPU has.
+/// SIMD kernels are checked against the scalar one when created; throws std::invalid_argument if CPU lacks the instructions
+std::unique_ptr<c_transform> make_transform(const std::string &name, const std::string &key);
+
+/// throws std::runtime_error if this program was compiled (e.g. with -march=native) for instructions that this CPU lacks;
+/// call it at start, before the compiler could use them
+void check_cpu_for_build();
@@ -0,0 +1,189 @@
+#include "udp_forwarder.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef UDP_GRO
+#define UDP_GRO 104 // linux/udp.h, since linux 5.0
+#endif
+
+namespace {
+const int poll_timeout_ms = 100; ///< how fast we notice the stop flag
+}
+
+c_udp_forwarder::c_udp_forwarder(uint16_t listen_port, size_t batch_size, size_t frame_size, bool gro)
+	: m_batch_size(batch_size), m_frame_size(frame_size), m_gro(gro), m_socket(-1), m_has_peer(false),
+	m_count_sent(0), m_count_sendmmsg(0), m_count_send_dropped(0), m_count_received(0), m_count_recvmmsg(0),
+	m_count_written(0), m_count_write_dropped(0)
+{
+	if (m_batch_size < 1) throw std::invalid_argument("forwarder batch must be >= 1");
+	std::memset(&m_peer, 0, sizeof(m_peer));
+	m_socket = socket(AF_INET6, SOCK_DGRAM, 0);
+	if (m_socket < 0) throw std::runtime_error(std::string("forwarder socket: ") + strerror(errno));
+	const int off = 0, on = 1;
+	setsockopt(m_socket, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // IPv4 peers too
+	const int buffer_size = 8 * 1024 * 1024; // bursts of whole batches should not be dropped by the socket
+	setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+	if (m_gro && (setsockopt(m_socket, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) < 0)) {
+		close(m_socket);
+		throw std::runtime_error(std::string("forwarder UDP_GRO: ") + strerror(errno));
+	}
+	sockaddr_in6 local;
+	std::memset(&local, 0, sizeof(local));
+	local.sin6_family = AF_INET6;
+	local.sin6_addr = in6addr_any;
+	local.sin6_port = htons(listen_port);
+	if (bind(m_socket, reinterpret_cast<sockaddr *>(&local), sizeof(local)) < 0) {
+		close(m_socket);
+		throw std::runtime_error(std::string("forwarder bind: ") + strerror(errno));
+	}
+}
+
+c_udp_forwarder::~c_udp_forwarder() {
+	close(m_socket);
+}
+
+void c_udp_forwarder::set_peer(const std::string &address, uint16_t port) {
+	m_peer.sin6_family = AF_INET6;
+	m_peer.sin6_port = htons(port);
+	if (inet_pton(AF_INET6, address.c_str(), &m_peer.sin6_addr) != 1) {
+		in_addr address4;
+		if (inet_pton(AF_INET, address.c_str(), &address4) != 1) throw std::invalid_argument("bad forward address " + address);
+		std::memset(&m_peer.sin6_addr, 0, sizeof(m_peer.sin6_addr)); // ::ffff:a.b.c.d
+		m_peer.sin6_addr.s6_addr[10] = m_peer.sin6_addr.s6_addr[11] = 0xFF;
+		std::memcpy(&m_peer.sin6_addr.s6_addr[12], &address4, sizeof(address4));
+	}
+	m_has_peer = true;
+}
+
+void c_udp_forwarder::run_tun_to_udp(int tun_fd, const std::atomic<bool> &stop, t_packet_handler handler) {
+	if (!m_has_peer) throw std::logic_error("forwarder has no peer");
+	fcntl(tun_fd, F_SETFL, fcntl(tun_fd, F_GETFL) | O_NONBLOCK); // read until nothing is ready, then send the batch
+
+	std::vector<unsigned char> frames(m_batch_size * m_frame_size);
+	std::vector<iovec> iovecs(m_batch_size);
+	std::vector<mmsghdr> msgs(m_batch_size);
+	for (size_t i = 0; i < m_batch_size; ++i) {
+		iovecs.at(i).iov_base = &frames.at(i * m_frame_size);
+		std::memset(&msgs.at(i), 0, sizeof(mmsghdr));
+		msgs.at(i).msg_hdr.msg_name = &m_peer;
+		msgs.at(i).msg_hdr.msg_namelen = sizeof(m_peer);
+		msgs.at(i).msg_hdr.msg_iov = &iovecs.at(i);
+		msgs.at(i).msg_hdr.msg_iovlen = 1;
+	}
+
+	pollfd poll_fd;
+	poll_fd.fd = tun_fd;
+	poll_fd.events = POLLIN;
+	while (!stop.load(std::memory_order_relaxed)) {
+		size_t count = 0;
+		while (count < m_batch_size) {
+			const ssize_t size = read(tun_fd, iovecs.at(count).iov_base, m_frame_size);
+			if (size < 0) {
+				if (errno == EINTR) continue;
+				if (errno != EAGAIN) throw std::runtime_error(std::string("forwarder TUN read: ") + strerror(errno));
+				break; // nothing more is ready
+			}
+			iovecs.at(count).iov_len = size;
+			handler(static_cast<const unsigned char *>(iovecs.at(count).iov_base), size);
+			++count;
+		}
+		if (count == 0) {
+			poll(&poll_fd, 1, poll_timeout_ms);
+			continue;
+		}
+
+		size_t done = 0;
+		while (done < count) {
+			const int sent = sendmmsg(m_socket, &msgs.at(done), static_cast<unsigned int>(count - done), 0);
+			m_count_sendmmsg.fetch_add(1, std::memory_order_relaxed);
+			if (sent < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == ENOBUFS) { // socket is full, like a real tunnel we drop
+					m_count_send_dropped.fetch_add(count - done, std::memory_order_relaxed);
+					break;
+				}
+				throw std::runtime_error(std::string("forwarder sendmmsg: ") + strerror(errno));
+			}
+			done += sent;
+		}
+		m_count_sent.fetch_add(done, std::memory_order_relaxed);
+	}
+}
+
+void c_udp_forwarder::run_udp_to_tun(int tun_fd, const std::atomic<bool> &stop, t_packet_handler handler) {
+	const timeval timeout{ 0, poll_timeout_ms * 1000 };
+	setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	const size_t control_size = CMSG_SPACE(sizeof(int));
+	std::vector<unsigned char> datagrams(m_batch_size * m_frame_size);
+	std::vector<unsigned char> controls(m_batch_size * control_size);
+	std::vector<iovec> iovecs(m_batch_size);
+	std::vector<mmsghdr> msgs(m_batch_size);
+	auto prepare = [&](size_t i) { // recvmmsg() overwrites the lengths
+		iovecs.at(i).iov_base = &datagrams.at(i * m_frame_size);
+		iovecs.at(i).iov_len = m_frame_size;
+		std::memset(&msgs.at(i), 0, sizeof(mmsghdr));
+		msgs.at(i).msg_hdr.msg_iov = &iovecs.at(i);
+		msgs.at(i).msg_hdr.msg_iovlen = 1;
+		if (m_gro) {
+			msgs.at(i).msg_hdr.msg_control = &controls.at(i * control_size);
+			msgs.at(i).msg_hdr.msg_controllen = control_size;
+		}
+	};
+
+	auto write_frame = [&](const unsigned char *frame, size_t size) {
+		handler(frame, size);
+		if (write(tun_fd, frame, size) == static_cast<ssize_t>(size)) m_count_written.fetch_add(1, std::memory_order_relaxed);
+		else m_count_write_dropped.fetch_add(1, std::memory_order_relaxed);
+	};
+
+	while (!stop.load(std::memory_order_relaxed)) {
+		for (size_t i = 0; i < m_batch_size; ++i) prepare(i);
+		const int received = recvmmsg(m_socket, msgs.data(), static_cast<unsigned int>(m_batch_size), MSG_WAITFORONE, nullptr);
+		if (received < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue; // EAGAIN - the timeout, check stop
+			throw std::runtime_error(std::string("forwarder recvmmsg: ") + strerror(errno));
+		}
+		m_count_recvmmsg.fetch_add(1, std::memory_order_relaxed);
+		size_t frames = 0;
+		for (int i = 0; i < received; ++i) {
+			const unsigned char *datagram = static_cast<const unsigned char *>(iovecs.at(i).iov_base);
+			const size_t size = msgs.at(i).msg_len;
+			size_t segment_size = size; // with GRO the kernel glued datagrams of segment_size (last can be shorter)
+			if (m_gro) {
+				for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs.at(i).msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs.at(i).msg_hdr, cmsg)) {
+					if ((cmsg->cmsg_level == IPPROTO_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+						int gso_size;
+						std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+						if (gso_size > 0) segment_size = gso_size;
+					}
+				}
+			}
+			for (size_t pos = 0; pos < size; pos += segment_size) {
+				write_frame(datagram + pos, std::min(segment_size, size - pos));
+				++frames;
+			}
+		}
+		m_count_received.fetch_add(frames, std::memory_order_relaxed);
+	}
+}
+
+void c_udp_forwarder::print_stats(std::ostream &out) const {
+	const size_t sent = m_count_sent.load(), sendmmsg_calls = m_count_sendmmsg.load();
+	const size_t received = m_count_received.load(), recvmmsg_calls = m_count_recvmmsg.load();
+	out << "Forward TUN->UDP: " << sent << " pck in " << sendmmsg_calls << " sendmmsg ("
+		<< (sendmmsg_calls ? static_cast<double>(sent) / sendmmsg_calls : 0.) << " per call), dropped " << m_count_send_dropped.load() << '\n';
+	out << "Forward UDP->TUN: " << received << " pck in " << recvmmsg_calls << " recvmmsg ("
+		<< (recvmmsg_calls ? static_cast<double>(received) / recvmmsg_calls : 0.) << " per call), written "
+		<< m_count_written.load() << ", dropped " << m_count_write_dropped.load() << '\n';
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <netinet/in.h>
+#include <string>
+
+/// VPN-like data plane over one UDP socket: frames read from TUN are sent to the peer in sendmmsg() batches,
+/// and datagrams received in recvmmsg() batches are written into the TUN. A datagram carries one whole frame
+/// as read from TUN (struct tun_pi, IP packet), so the peer can be a second instance of this program.
+/// Each run_* function is the loop of one thread; many run_tun_to_udp() threads (one per queue) can share the object.
+class c_udp_forwarder final {
+	public:
+		using t_packet_handler = std::function<void(const unsigned char *data, size_t size)>;
+
+		/// listen_port - local UDP port to receive on, 0 for any; batch_size - datagrams per sendmmsg()/recvmmsg()
+		/// frame_size - biggest frame; gro - use UDP_GRO, then one received datagram can carry many frames of same size
+		c_udp_forwarder(uint16_t listen_port, size_t batch_size, size_t frame_size, bool gro);
+		~c_udp_forwarder();
+		c_udp_forwarder(const c_udp_forwarder &) = delete;
+		c_udp_forwarder &operator=(const c_udp_forwarder &) = delete;
+
+		/// where run_tun_to_udp() sends to; address is IPv6, or IPv4 (then used as IPv4-mapped IPv6)
+		void set_peer(const std::string &address, uint16_t port);
+
+		/// reads all frames that are ready on tun_fd (up to the batch size), calls handler for each, sends them in one sendmmsg()
+		void run_tun_to_udp(int tun_fd, const std::atomic<bool> &stop, t_packet_handler handler);
+		/// receives datagrams, calls handler for each frame, writes the frame into tun_fd
+		void run_udp_to_tun(int tun_fd, const std::atomic<bool> &stop, t_packet_handler handler);
+
+		void print_stats(std::ostream &out) const; ///< frames and syscalls of each direction
+
+	private:
+		const size_t m_batch_size;
+		const size_t m_frame_size;
+		const bool m_gro;
+		int m_socket;
+		sockaddr_in6 m_peer;
+		bool m_has_peer;
+
+		std::atomic<size_t> m_count_sent; ///< frames sent to peer
+		std::atomic<size_t> m_count_sendmmsg;
+		std::atomic<size_t> m_count_send_dropped; ///< frames that sendmmsg() did not take
+		std::atomic<size_t> m_count_received; ///< frames received (after GRO split)
+		std::atomic<size_t> m_count_recvmmsg;
+		std::atomic<size_t> m_count_written; ///< frames written into TUN
+		std::atomic<size_t> m_count_write_dropped; ///< frames that TUN did not take
+};
@@ -0,0 +1,226 @@
+#include "uring_rx.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+int uring_setup(unsigned entries, io_uring_params *params) {
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void *arg, size_t arg_size) {
+	return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size));
+}
+
+int uring_register(int ring_fd, unsigned opcode, const void *arg, unsigned nr_args) {
+	return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+const __u64 cancel_user_data = ~__u64(0); ///< of the IORING_OP_ASYNC_CANCEL requests, reads have the buffer nr
+
+template <typename T> T *ring_field(void *ring, __u32 offset) {
+	return reinterpret_cast<T *>(static_cast<unsigned char *>(ring) + offset);
+}
+
+} // namespace
+
+c_uring_rx::c_uring_rx(int fd, size_t queue_depth, size_t buffer_size, t_packet_handler handler, int numa_node)
+	: m_fd(fd), m_handler(handler), m_buffer_pool(new c_buffer_pool(buffer_size, queue_depth, numa_node)),
+	m_reading(queue_depth, false), m_count_reading(0),
+	m_ring_fd(-1), m_sq_ring(MAP_FAILED), m_sq_ring_size(0), m_cq_ring(MAP_FAILED), m_cq_ring_size(0),
+	m_sqes(static_cast<io_uring_sqe *>(MAP_FAILED)), m_sqes_size(0),
+	m_to_submit(0), m_count_enter(0), m_count_packets(0)
+{
+	std::memset(&m_params, 0, sizeof(m_params));
+	m_ring_fd = uring_setup(static_cast<unsigned>(queue_depth), &m_params);
+	if (m_ring_fd < 0) throw std::runtime_error(std::string("io_uring_setup: ") + strerror(errno));
+	if (!(m_params.features & IORING_FEAT_EXT_ARG)) {
+		close(m_ring_fd);
+		throw std::runtime_error("io_uring: kernel without IORING_FEAT_EXT_ARG (need linux 5.11+)");
+	}
+
+	m_sq_ring_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+	m_cq_ring_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+	const bool single_mmap = m_params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap) m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+	m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+	if (single_mmap) m_cq_ring = m_sq_ring;
+	else m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+	m_sqes_size = m_params.sq_entries * sizeof(io_uring_sqe);
+	m_sqes = static_cast<io_uring_sqe *>(mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+	if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED) {
+		unmap_all();
+		throw std::runtime_error("io_uring: mmap of rings failed");
+	}
+
+	m_sq_head = ring_field<unsigned>(m_sq_ring, m_params.sq_off.head);
+	m_sq_tail = ring_field<unsigned>(m_sq_ring, m_params.sq_off.tail);
+	m_sq_mask = ring_field<unsigned>(m_sq_ring, m_params.sq_off.ring_mask);
+	m_sq_array = ring_field<unsigned>(m_sq_ring, m_params.sq_off.array);
+	m_cq_head = ring_field<unsigned>(m_cq_ring, m_params.cq_off.head);
+	m_cq_tail = ring_field<unsigned>(m_cq_ring, m_params.cq_off.tail);
+	m_cq_mask = ring_field<unsigned>(m_cq_ring, m_params.cq_off.ring_mask);
+	m_cqes = ring_field<io_uring_cqe>(m_cq_ring, m_params.cq_off.cqes);
+
+	// register all buffers once, then reads use them as fixed buffers (no page pinning per read)
+	std::vector<iovec> iovecs;
+	for (size_t i = 0; i < queue_depth; i++) {
+		m_buffers.push_back(m_buffer_pool->acquire());
+		iovecs.push_back(iovec{ m_buffers.back(), buffer_size });
+	}
+	if (uring_register(m_ring_fd, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned>(iovecs.size())) < 0) {
+		int err = errno;
+		unmap_all();
+		throw std::runtime_error(std::string("io_uring register buffers: ") + strerror(err));
+	}
+}
+
+c_uring_rx::~c_uring_rx() {
+	if (m_count_reading > 0) { // the kernel could still write into the buffers, so never give their memory back
+		std::cerr << "io_uring: " << m_count_reading << " reads not cancelled, leaving their buffers allocated" << std::endl;
+		m_buffer_pool.release();
+	}
+	unmap_all();
+}
+
+void c_uring_rx::unmap_all() {
+	if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqes_size);
+	if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+	if (m_sq_ring != MAP_FAILED) munmap(m_sq_ring, m_sq_ring_size);
+	if (m_ring_fd >= 0) close(m_ring_fd);
+	m_ring_fd = -1;
+	m_sq_ring = m_cq_ring = MAP_FAILED;
+	m_sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+}
+
+void c_uring_rx::queue_read(size_t buffer_nr) {
+	// only this thread writes the SQ tail, kernel moves the head
+	const unsigned tail = *m_sq_tail;
+	const unsigned index = tail & *m_sq_mask;
+	io_uring_sqe &sqe = m_sqes[index];
+	std::memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_READ_FIXED;
+	sqe.fd = m_fd;
+	sqe.addr = reinterpret_cast<__u64>(m_buffers.at(buffer_nr));
+	sqe.len = static_cast<__u32>(m_buffer_pool->get_buffer_size());
+	sqe.buf_index = static_cast<__u16>(buffer_nr);
+	sqe.user_data = buffer_nr;
+	m_sq_array[index] = index;
+	__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++m_to_submit;
+	m_reading.at(buffer_nr) = true;
+	++m_count_reading;
+}
+
+void c_uring_rx::see_read_done(size_t buffer_nr) {
+	m_reading.at(buffer_nr) = false;
+	--m_count_reading;
+}
+
+void c_uring_rx::cancel_reads() {
+	__kernel_timespec timeout{ 0, 100 * 1000 * 1000 };
+	io_uring_getevents_arg wait_arg;
+	std::memset(&wait_arg, 0, sizeof(wait_arg));
+	wait_arg.ts = reinterpret_cast<__u64>(&timeout);
+	// submits what is queued, and reaps the completions (waiting for min_complete of them)
+	auto submit_and_reap = [&](unsigned min_complete) {
+		const int ret = uring_enter(m_ring_fd, m_to_submit, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			&wait_arg, sizeof(wait_arg));
+		if (ret < 0) return (errno == ETIME) || (errno == EINTR);
+		m_to_submit -= static_cast<unsigned>(ret);
+		unsigned head = *m_cq_head;
+		const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const io_uring_cqe &cqe = m_cqes[head & *m_cq_mask];
+			if (cqe.user_data != cancel_user_data) see_read_done(static_cast<size_t>(cqe.user_data));
+		}
+		__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+		return true;
+	};
+
+	// a cancel of a read that is just completing can miss it, so cancel what is left again on each round
+	for (int round = 0; (m_count_reading > 0) && (round < 50); ++round) { // 5 s at most
+		for (size_t buffer_nr = 0; buffer_nr < m_buffers.size(); buffer_nr++) {
+			if (!m_reading.at(buffer_nr)) continue;
+			if (*m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_params.sq_entries) {
+				if (!submit_and_reap(0)) return;
+			}
+			const unsigned tail = *m_sq_tail;
+			const unsigned index = tail & *m_sq_mask;
+			io_uring_sqe &sqe = m_sqes[index];
+			std::memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = IORING_OP_ASYNC_CANCEL;
+			sqe.fd = -1;
+			sqe.addr = buffer_nr; // user_data of the read
+			sqe.user_data = cancel_user_data;
+			m_sq_array[index] = index;
+			__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+			++m_to_submit;
+		}
+		if (!submit_and_reap(1)) return;
+	}
+}
+
+void c_uring_rx::run(const std::atomic<bool> &stop) {
+	for (size_t i = 0; i < m_buffers.size(); i++) queue_read(i);
+
+	__kernel_timespec timeout{ 0, 100 * 1000 * 1000 }; // to check the stop flag while idle
+	io_uring_getevents_arg wait_arg;
+	std::memset(&wait_arg, 0, sizeof(wait_arg));
+	wait_arg.ts = reinterpret_cast<__u64>(&timeout);
+
+	unsigned reaped = *m_cq_head; // CQ head after the last completion we took, to give them back if we throw
+	try {
+		while (!stop.load(std::memory_order_relaxed)) {
+			// submit all re-queued reads and wait for at least one completion, in one syscall
+			int ret = uring_enter(m_ring_fd, m_to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &wait_arg, sizeof(wait_arg));
+			++m_count_enter;
+			if (ret < 0) {
+				if (errno == ETIME || errno == EINTR) continue;
+				throw std::runtime_error(std::string("io_uring_enter: ") + strerror(errno));
+			}
+			m_to_submit -= static_cast<unsigned>(ret);
+
+			unsigned head = *m_cq_head;
+			const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head) {
+				const io_uring_cqe &cqe = m_cqes[head & *m_cq_mask];
+				const size_t buffer_nr = static_cast<size_t>(cqe.user_data);
+				see_read_done(buffer_nr);
+				reaped = head + 1;
+				if (cqe.res > 0) {
+					++m_count_packets;
+					m_handler(m_buffers.at(buffer_nr), static_cast<size_t>(cqe.res));
+				} else if ((cqe.res == 0) || ((cqe.res != -EAGAIN) && (cqe.res != -EINTR))) { // the fd is gone, reading again would spin
+					throw std::runtime_error(std::string("io_uring read: ") + (cqe.res ? strerror(-cqe.res) : "end of file"));
+				}
+				queue_read(buffer_nr);
+			}
+			__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+		}
+	} catch (...) {
+		__atomic_store_n(m_cq_head, reaped, __ATOMIC_RELEASE);
+		cancel_reads();
+		throw;
+	}
+	// here and not in the destructor: the kernel completes a cancelled read by task work of the thread that queued it
+	cancel_reads();
+}
+
+size_t c_uring_rx::get_count_enter() const {
+	return m_count_enter;
+}
+
+size_t c_uring_rx::get_count_packets() const {
+	return m_count_packets;
+}
+
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <linux/io_uring.h>
+#include <memory>
+#include <vector>
+#include "buffer_pool.hpp"
+
+/// Receive engine that keeps many reads queued on one fd using io_uring (without liburing, raw syscalls).
+/// Each read uses own registered (fixed) buffer; completed reads are handled and re-queued in batches,
+/// so one io_uring_enter() submits all re-armed reads and collects all completions that are ready.
+/// One object is used by one thread.
+class c_uring_rx final {
+	public:
+		using t_packet_handler = std::function<void(const unsigned char *data, size_t size)>;
+
+		/// queue_depth - how many reads are kept in flight; numa_node - where to allocate the buffers (-1 for default)
+		c_uring_rx(int fd, size_t queue_depth, size_t buffer_size, t_packet_handler handler, int numa_node = -1);
+		~c_uring_rx();
+		c_uring_rx(const c_uring_rx &) = delete;
+		c_uring_rx &operator=(const c_uring_rx &) = delete;
+
+		/// read packets and call handler for them, until stop is set; throws std::runtime_error if a read fails
+		/// (other then EAGAIN/EINTR) or finds end of file. Either way it cancels the reads still in flight and waits
+		/// for them before it returns, so the buffers can be freed then
+		void run(const std::atomic<bool> &stop);
+
+		size_t get_count_enter() const; ///< how many io_uring_enter syscalls were done
+		size_t get_count_packets() const; ///< how many packets were read
+
+	private:
+		const int m_fd; ///< the fd we read from
+		t_packet_handler m_handler;
+		/// registered in the ring, buffer for read nr i is m_buffers[i]; leaked if reads can not be cancelled
+		std::unique_ptr<c_buffer_pool> m_buffer_pool;
+		std::vector<unsigned char *> m_buffers;
+		std::vector<bool> m_reading; ///< is the read into buffer i queued or in flight (the kernel may write into it)
+		size_t m_count_reading;
+
+		int m_ring_fd;
+		io_uring_params m_params;
+		void *m_sq_ring; ///< mmaped SQ ring (and CQ ring too, if kernel has IORING_FEAT_SINGLE_MMAP)
+		size_t m_sq_ring_size;
+		void *m_cq_ring; ///< mmaped CQ ring
+		size_t m_cq_ring_size;
+		io_uring_sqe *m_sqes; ///< mmaped SQE array
+		size_t m_sqes_size;
+
+		unsigned *m_sq_head, *m_sq_tail, *m_sq_mask, *m_sq_array;
+		unsigned *m_cq_head, *m_cq_tail, *m_cq_mask;
+		io_uring_cqe *m_cqes;
+
+		unsigned m_to_submit; ///< SQEs prepared but not yet submitted
+		size_t m_count_enter;
+		size_t m_count_packets;
+
+		void queue_read(size_t buffer_nr); ///< prepares SQE of a read into buffer buffer_nr
+		void see_read_done(size_t buffer_nr); ///< the read into buffer buffer_nr completed
+		/// cancels all reads and reaps their completions, on the thread that queued them; the reads that did not complete
+		/// in few seconds stay in m_count_reading (and the destructor leaks their buffers)
+		void cancel_reads();
+		void unmap_all();
+};
+
@@ -0,0 +1,177 @@
+#include "verify.hpp"
+#include <cstring>
+#include <netinet/in.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VERIFY_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+#ifdef VERIFY_X86
+/// 32 bit words zero-extended into 64 bit lanes, so 2^32 words can be added before any carry is lost
+__attribute__((target("avx2")))
+uint64_t checksum_add_avx2(const unsigned char *data, size_t size, uint64_t sum) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+	size_t pos = 0;
+	for (; pos + 64 <= size; pos += 64) {
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos) + 1);
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+		acc2 = _mm256_add_epi64(acc2, _mm256_unpacklo_epi32(b, zero));
+		acc3 = _mm256_add_epi64(acc3, _mm256_unpackhi_epi32(b, zero));
+	}
+	const __m256i acc = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1), _mm256_add_epi64(acc2, acc3));
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+	sum = checksum_add_scalar(data + pos, size - pos, sum);
+	for (uint64_t lane : lanes) {
+		const uint64_t before = sum;
+		sum += lane;
+		if (sum < before) ++sum; // end-around carry
+	}
+	return sum;
+}
+
+__attribute__((target("avx2")))
+bool is_filled_with_avx2(const unsigned char *data, size_t size, unsigned char value) {
+	const __m256i expected = _mm256_set1_epi8(static_cast<char>(value));
+	size_t pos = 0;
+	for (; pos + 32 <= size; pos += 32) {
+		const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+		if (static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, expected))) != 0xFFFFFFFFu) return false;
+	}
+	for (; pos < size; ++pos) if (data[pos] != value) return false;
+	return true;
+}
+
+const bool cpu_has_avx2 = [] { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }(); // can run before main
+#endif
+}
+
+uint64_t checksum_add_scalar(const unsigned char *data, size_t size, uint64_t sum) {
+	uint64_t add = 0; // 32 bit words, so no carry is lost for 2^32 of them
+	size_t pos = 0;
+	for (; pos + 4 <= size; pos += 4) {
+		uint32_t word;
+		std::memcpy(&word, data + pos, sizeof(word));
+		add += word;
+	}
+	if (pos + 2 <= size) {
+		uint16_t word;
+		std::memcpy(&word, data + pos, sizeof(word));
+		add += word;
+		pos += 2;
+	}
+	if (pos < size) { // odd byte is padded with zero after it
+		const unsigned char last[2] = { data[pos], 0 };
+		uint16_t word;
+		std::memcpy(&word, last, sizeof(word));
+		add += word;
+	}
+	const uint64_t before = sum;
+	sum += add;
+	if (sum < before) ++sum;
+	return sum;
+}
+
+uint64_t checksum_add(const unsigned char *data, size_t size, uint64_t sum) {
+#ifdef VERIFY_X86
+	if (cpu_has_avx2 && (size >= 64)) return checksum_add_avx2(data, size, sum);
+#endif
+	return checksum_add_scalar(data, size, sum);
+}
+
+uint16_t checksum_fold(uint64_t sum) {
+	while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+	return static_cast<uint16_t>(sum);
+}
+
+namespace {
+/// sum of the IPv4 or IPv6 pseudo header; for IPv6 the destination is from the IPv6 header (routing header is not followed)
+uint64_t add_pseudo_header(const unsigned char *ip, unsigned ip_version, size_t udp_size, uint64_t sum) {
+	if (ip_version == 6) { // source, destination, length, next header
+		sum = checksum_add(ip + 8, 32, sum);
+		const unsigned char rest[8] = { static_cast<unsigned char>(udp_size >> 24), static_cast<unsigned char>(udp_size >> 16),
+			static_cast<unsigned char>(udp_size >> 8), static_cast<unsigned char>(udp_size), 0, 0, 0, IPPROTO_UDP };
+		return checksum_add(rest, sizeof(rest), sum);
+	}
+	sum = checksum_add(ip + 12, 8, sum); // source, destination, zero, protocol, length
+	const unsigned char rest[4] = { 0, IPPROTO_UDP, static_cast<unsigned char>(udp_size >> 8), static_cast<unsigned char>(udp_size) };
+	return checksum_add(rest, sizeof(rest), sum);
+}
+}
+
+uint16_t get_udp_checksum(const unsigned char *ip, unsigned ip_version, size_t l4_pos, size_t udp_size) {
+	const uint64_t sum = checksum_add(ip + l4_pos, udp_size, add_pseudo_header(ip, ip_version, udp_size, 0));
+	const uint16_t checksum = static_cast<uint16_t>(~checksum_fold(sum));
+	return (checksum == 0) ? 0xFFFF : checksum; // 0 means "no checksum" on the wire
+}
+
+bool is_filled_with(const unsigned char *data, size_t size, unsigned char value) {
+#ifdef VERIFY_X86
+	if (cpu_has_avx2) return is_filled_with_avx2(data, size, value);
+#endif
+	for (size_t pos = 0; pos < size; ++pos) if (data[pos] != value) return false;
+	return true;
+}
+
+c_packet_verify::c_counts::c_counts()
+	: m_checksum_ok(0), m_checksum_bad(0), m_unverifiable(0), m_marker_bad(0), m_pattern_bad(0)
+{ }
+
+void c_packet_verify::c_counts::add(std::atomic<uint64_t> &counter) {
+	counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void c_packet_verify::see_udp_packet(const c_ip_packet &packet) {
+	c_counts & counts = m_counts.local();
+	const unsigned char *udp = packet.get_udp_payload() - 8;
+	if ((udp[6] == 0) && (udp[7] == 0)) { // no checksum (allowed only for IPv4, but TUN does not care)
+		c_counts::add(counts.m_unverifiable);
+		return;
+	}
+	const unsigned char *ip = udp - packet.get_l4_pos();
+	const size_t udp_size = packet.get_udp_payload_size() + 8;
+	uint64_t sum = add_pseudo_header(ip, packet.get_version(), udp_size, 0);
+	sum = checksum_add(udp, udp_size, sum); // with the checksum in it, all adds up to 0xFFFF
+	if (checksum_fold(sum) == 0xFFFF) c_counts::add(counts.m_checksum_ok);
+	else c_counts::add(counts.m_checksum_bad);
+}
+
+void c_packet_verify::see_unverifiable() {
+	c_counts::add(m_counts.local().m_unverifiable);
+}
+
+void c_packet_verify::see_bad_marker() {
+	c_counts::add(m_counts.local().m_marker_bad);
+}
+
+bool c_packet_verify::see_filler(const unsigned char *filler, size_t filler_size) {
+	if (is_filled_with(filler, filler_size, 'x')) return true;
+	c_counts::add(m_counts.local().m_pattern_bad);
+	return false;
+}
+
+c_packet_verify::c_totals c_packet_verify::get_totals() const {
+	c_totals sum{ 0, 0, 0, 0, 0 };
+	m_counts.for_each([&sum](const c_counts & counts) {
+		sum.m_count_checksum_ok += counts.m_checksum_ok.load(std::memory_order_relaxed);
+		sum.m_count_checksum_bad += counts.m_checksum_bad.load(std::memory_order_relaxed);
+		sum.m_count_unverifiable += counts.m_unverifiable.load(std::memory_order_relaxed);
+		sum.m_count_marker_bad += counts.m_marker_bad.load(std::memory_order_relaxed);
+		sum.m_count_pattern_bad += counts.m_pattern_bad.load(std::memory_order_relaxed);
+	});
+	return sum;
+}
+
+void c_packet_verify::print(std::ostream &out) const {
+	const c_totals totals = get_totals();
+	out << "Verify: checksum ok=" << totals.m_count_checksum_ok << " bad=" << totals.m_count_checksum_bad
+		<< " unverifiable=" << totals.m_count_unverifiable
+		<< " ; bad marker=" << totals.m_count_marker_bad << " bad pattern=" << totals.m_count_pattern_bad;
+	if (totals.m_count_checksum_bad || totals.m_count_marker_bad || totals.m_count_pattern_bad) out << " CORRUPTED-PACKETS";
+	out << std::endl;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "ip_packet.hpp"
+#include "thread_slots.hpp"
+
+/// Internet checksum (RFC 1071) pieces. The sum is of 16 bit words as they are in memory (host order), which gives
+/// the checksum in memory order too; every piece must start at an even offset of the checksummed data.
+uint64_t checksum_add(const unsigned char *data, size_t size, uint64_t sum); ///< uses AVX2 if CPU has it
+uint64_t checksum_add_scalar(const unsigned char *data, size_t size, uint64_t sum); ///< the reference
+uint16_t checksum_fold(uint64_t sum); ///< ones' complement sum in 16 bits (0xFFFF if the data had valid checksum in it)
+
+/// checksum of UDP (header with checksum 0, and payload) with the IPv4 or IPv6 pseudo header, to write into UDP header
+/// (with memcpy, it is in memory order); ip - IP packet, the UDP header at l4_pos, udp_size from the UDP length field
+uint16_t get_udp_checksum(const unsigned char *ip, unsigned ip_version, size_t l4_pos, size_t udp_size);
+
+/// are all bytes of data equal to value (e.g. the filler of test packets); AVX2 if CPU has it
+bool is_filled_with(const unsigned char *data, size_t size, unsigned char value);
+
+/// Integrity checks of received test packets: UDP checksum, marker, and the filler pattern of payload.
+/// Safe to call from many threads, counts are per thread.
+class c_packet_verify final {
+	public:
+		struct c_totals {
+			uint64_t m_count_checksum_ok, m_count_checksum_bad;
+			uint64_t m_count_unverifiable; ///< no checksum in packet (0, or left for offload), not checked
+			uint64_t m_count_marker_bad, m_count_pattern_bad;
+		};
+
+		void see_udp_packet(const c_ip_packet &packet); ///< checks the UDP checksum, packet.is_udp() must be true
+		void see_unverifiable(); ///< count a packet that has no checksum to check (e.g. GSO, checksum offload)
+		void see_bad_marker(); ///< count a payload without our marker
+		/// checks the filler after the header (marker, index, time) of test payload; returns false if bad
+		bool see_filler(const unsigned char *filler, size_t filler_size);
+
+		c_totals get_totals() const;
+		void print(std::ostream &out) const;
+
+	private:
+		struct c_counts {
+			std::atomic<uint64_t> m_checksum_ok, m_checksum_bad, m_unverifiable, m_marker_bad, m_pattern_bad;
+			c_counts();
+			static void add(std::atomic<uint64_t> &counter); ///< the thread of this slot is the only writer
+		};
+		c_thread_slots<c_counts> m_counts;
+};
@@ -0,0 +1,69 @@
+#include "vnet_hdr.hpp"
+#include "Endian.h"
+#include "ip_packet.hpp"
+#include <netinet/in.h>
+
+c_vnet_packet::c_vnet_packet(const unsigned char *data, size_t size)
+	: m_ip(data + sizeof(t_virtio_net_hdr)), m_ip_size(0), m_gso_type(VIRTIO_NET_HDR_GSO_NONE), m_gso_size(0),
+	m_l4_proto(0), m_checksum_partial(false), m_headers_size(0), m_valid(false)
+{
+	if (size < sizeof(t_virtio_net_hdr) + 1) return;
+	const t_virtio_net_hdr *hdr = reinterpret_cast<const t_virtio_net_hdr *>(data);
+	m_ip_size = size - sizeof(t_virtio_net_hdr);
+	m_gso_type = hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+	m_gso_size = Endian_littleEndianToHost16(hdr->gso_size); // TUN uses little endian vnet header (unless TUNSETVNETBE)
+
+	// where does L4 start: kernel tells us in csum_start when checksum is left for us, else parse the IP headers
+	const c_ip_packet ip(m_ip, m_ip_size);
+	if (!ip.is_valid() || (ip.get_l4_pos() == 0)) return;
+	m_l4_proto = ip.get_l4_proto();
+	size_t l4_pos = ip.get_l4_pos();
+	m_checksum_partial = hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM;
+	if (m_checksum_partial) l4_pos = Endian_littleEndianToHost16(hdr->csum_start);
+
+	if (m_l4_proto == IPPROTO_UDP) m_headers_size = l4_pos + 8;
+	else if (m_l4_proto == IPPROTO_TCP) {
+		if (m_ip_size < l4_pos + 20) return;
+		m_headers_size = l4_pos + (m_ip[l4_pos + 12] >> 4) * 4;
+	} else m_headers_size = l4_pos;
+
+	if (m_headers_size > m_ip_size) return;
+	if (is_gso() && m_gso_size == 0) return;
+	m_valid = true;
+}
+
+bool c_vnet_packet::is_valid() const {
+	return m_valid;
+}
+
+bool c_vnet_packet::is_gso() const {
+	return m_gso_type != VIRTIO_NET_HDR_GSO_NONE;
+}
+
+bool c_vnet_packet::is_udp() const {
+	return m_l4_proto == IPPROTO_UDP;
+}
+
+bool c_vnet_packet::is_checksum_partial() const {
+	return m_checksum_partial;
+}
+
+size_t c_vnet_packet::get_segment_count() const {
+	if (!m_valid || !is_gso()) return 1;
+	const size_t payload = m_ip_size - m_headers_size;
+	if (payload == 0) return 1;
+	return (payload + m_gso_size - 1) / m_gso_size;
+}
+
+size_t c_vnet_packet::get_headers_size() const {
+	return m_headers_size;
+}
+
+const unsigned char *c_vnet_packet::get_ip_packet() const {
+	return m_ip;
+}
+
+size_t c_vnet_packet::get_ip_packet_size() const {
+	return m_ip_size;
+}
+
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// linux/virtio_net.h can not be included from C++ (it has a member named "class"), so this is a copy of it
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1 ///< use csum_start, csum_offset
+#define VIRTIO_NET_HDR_GSO_NONE 0 ///< not a GSO frame
+#define VIRTIO_NET_HDR_GSO_TCPV4 1 ///< GSO frame, IPv4 TCP (TSO)
+#define VIRTIO_NET_HDR_GSO_UDP 3 ///< GSO frame, IPv4 UDP (UFO)
+#define VIRTIO_NET_HDR_GSO_TCPV6 4 ///< GSO frame, IPv6 TCP
+#define VIRTIO_NET_HDR_GSO_UDP_L4 5 ///< GSO frame, UDP segmentation (USO), linux 5.0+
+#define VIRTIO_NET_HDR_GSO_ECN 0x80 ///< TCP has ECN set
+
+/// struct virtio_net_hdr, as TUN gives it (little endian, unless TUNSETVNETBE)
+struct t_virtio_net_hdr {
+	uint8_t flags; ///< VIRTIO_NET_HDR_F_*
+	uint8_t gso_type; ///< VIRTIO_NET_HDR_GSO_*
+	uint16_t hdr_len; ///< length of the headers (for TUN: IP and L4)
+	uint16_t gso_size; ///< bytes to append to hdr_len per frame
+	uint16_t csum_start; ///< position to start checksumming from
+	uint16_t csum_offset; ///< offset after that to place checksum
+};
+static_assert(sizeof(t_virtio_net_hdr) == 10, "virtio_net_hdr layout");
+
+/// One read from a TUN opened with IFF_VNET_HDR: the virtio_net_hdr and then the packet,
+/// which can be a GSO super-packet (one set of IP+L4 headers, and payload of many segments).
+class c_vnet_packet final {
+	public:
+		/// data - as read from TUN, starting at the virtio_net_hdr (so after the PI header, if any)
+		c_vnet_packet(const unsigned char *data, size_t size);
+
+		bool is_valid() const; ///< is this large enough for the headers we parsed
+		bool is_gso() const;
+		bool is_udp() const;
+		bool is_checksum_partial() const; ///< VIRTIO_NET_HDR_F_NEEDS_CSUM: L4 checksum has only the pseudo header sum
+		size_t get_segment_count() const; ///< how many packets this is on the wire (1 if not GSO)
+		size_t get_headers_size() const; ///< size of IP and L4 headers, that each segment gets a copy of
+		const unsigned char *get_ip_packet() const; ///< the IP packet after the virtio_net_hdr
+		size_t get_ip_packet_size() const;
+
+		/// calls fn(payload, payload_size) for the UDP payload of each segment (nothing if not UDP)
+		template <typename F> void for_each_udp_payload(F fn) const;
+
+	private:
+		const unsigned char *m_ip; ///< the IP packet
+		size_t m_ip_size;
+		uint8_t m_gso_type; ///< VIRTIO_NET_HDR_GSO_* without the ECN bit
+		size_t m_gso_size; ///< payload size of each segment (but maybe the last one)
+		uint8_t m_l4_proto; ///< IPPROTO_UDP, IPPROTO_TCP, or other
+		bool m_checksum_partial;
+		size_t m_headers_size;
+		bool m_valid;
+};
+
+template <typename F> void c_vnet_packet::for_each_udp_payload(F fn) const {
+	if (!m_valid || !is_udp()) return;
+	const unsigned char *payload = m_ip + m_headers_size;
+	size_t left = m_ip_size - m_headers_size;
+	const size_t segment_size = is_gso() ? m_gso_size : left;
+	do {
+		size_t size = (left < segment_size) ? left : segment_size;
+		fn(payload, size);
+		payload += size;
+		left -= size;
+	} while (left > 0);
+}
+